@@ -3,19 +3,26 @@ import numpy as np
 import sys
 from array import array
 
-FORMATS = ['PHDE', 'PHIR']
+FORMATS = {'PHDE': 'f', 'PHIR': 'f', 'PHDU': 'u2', 'PHIU': 'u2'}
 
 filename = sys.argv[1]
 
 with open(filename, 'rb') as f:
     format_arr = np.fromfile(f, dtype='i1', count=4)
-    assert ''.join(map(chr, format_arr)) in FORMATS
+    magic = ''.join(map(chr, format_arr))
+    assert magic in FORMATS
 
-    size_arr = np.fromfile(f, dtype='i4', count=2)
+    size_arr = np.fromfile(f, dtype='u4', count=2)
     width, height = size_arr
-    print(size_arr)
+    if width == 0:
+        # Version 2 of the format, see data_format.md
+        version = height
+        header_size, width, height, _, codec = np.fromfile(f, dtype='u4', count=5)
+        assert version == 2 and codec == 0
+        f.seek(header_size)
+    print(width, height)
 
-    data_arr = np.fromfile(f, dtype='f', count=height * width)
+    data_arr = np.fromfile(f, dtype=FORMATS[magic], count=height * width)
 
 photo = np.asarray(data_arr)
 photo = photo.reshape(height, width)
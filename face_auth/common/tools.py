@@ -51,36 +51,46 @@ def load_color_image_from_file(filename: str):
     return np.array(PIL.Image.open(filename), dtype='uint8')
 
 
-def load_depth_photo(path: str) -> np.ndarray:
+def load_depth_or_ir_photo(path: str, float_magic: str, uint16_magic: str) -> np.ndarray:
     """
-        :param path:
+        Reads an uncompressed depth or IR file of either version of data_format.md
         :return: 2D np.ndarray of floats
     """
     with open(path, 'rb') as f:
         format_arr = np.fromfile(f, dtype=np.int8, count=4)
-        assert ''.join(map(chr, format_arr)) == 'PHDE'
-        size_arr = np.fromfile(f, dtype=np.int32, count=2)
+        magic = ''.join(map(chr, format_arr))
+        assert magic in (float_magic, uint16_magic)
+        size_arr = np.fromfile(f, dtype=np.uint32, count=2)
         width, height = size_arr
-        data_arr = np.fromfile(f, dtype=np.float32, count=height * width)
-        photo = np.asarray(data_arr)
+        if width == 0:
+            # Version 2: the version is where version 1 has the height, the size follows the header size and the
+            # pixels follow the header.
+            version = height
+            header_size, width, height, _, codec = np.fromfile(f, dtype=np.uint32, count=5)
+            assert version == 2, "Unsupported version %d of file %s" % (version, path)
+            assert codec == 0, "File %s is coded with the depth codec, use libkinect to read it" % path
+            f.seek(header_size)
+        dtype = np.uint16 if magic == uint16_magic else np.float32
+        data_arr = np.fromfile(f, dtype=dtype, count=height * width)
+        photo = np.asarray(data_arr, dtype=np.float32)
         photo = photo.reshape(height, width)
         return photo
 
 
+def load_depth_photo(path: str) -> np.ndarray:
+    """
+        :param path:
+        :return: 2D np.ndarray of floats
+    """
+    return load_depth_or_ir_photo(path, 'PHDE', 'PHDU')
+
+
 def load_ir_photo(path: str) -> np.ndarray:
     """
             :param path:
             :return: 2D np.ndarray of floats
         """
-    with open(path, 'rb') as f:
-        format_arr = np.fromfile(f, dtype=np.int8, count=4)
-        assert ''.join(map(chr, format_arr)) == 'PHIR'
-        size_arr = np.fromfile(f, dtype=np.int32, count=2)
-        width, height = size_arr
-        data_arr = np.fromfile(f, dtype=np.float32, count=height * width)
-        photo = np.asarray(data_arr)
-        photo = photo.reshape(height, width)
-        return photo
+    return load_depth_or_ir_photo(path, 'PHIR', 'PHIU')
 
 
 def change_image_mode(source_mode: str, output_mode: str, img: np.ndarray) -> np.ndarray:
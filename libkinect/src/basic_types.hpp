@@ -20,20 +20,36 @@
 #ifndef BASIC_TYPES_HPP
 #define BASIC_TYPES_HPP
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include "frame_pool.hpp"
 
 // Declarations
 
+// Elements in one piece of memory which the array doesn't own, e.g. a row of a matrix or all of its pixels.
 template <typename ElementType>
 class Array {
  public:
+   using value_type = std::remove_const_t<ElementType>;
+   using iterator = ElementType *;
+   using const_iterator = ElementType const *;
+
    Array(ElementType *memory, size_t size);
 
    ElementType *begin();
    ElementType *end();
    ElementType const *begin() const;
    ElementType const *end() const;
+   ElementType &operator[](size_t i);
+   ElementType const &operator[](size_t i) const;
+   ElementType *data();
+   ElementType const *data() const;
 
    size_t const size;
 
@@ -41,28 +57,264 @@ class Array {
    ElementType *const memory;
 };
 
+// Random access iterator over the rows of a matrix or a view, each row seen as an Array.
+template <typename ElementType>
+class RowIterator {
+ public:
+   using iterator_category = std::random_access_iterator_tag;
+   using value_type = Array<ElementType>;
+   using difference_type = ptrdiff_t;
+   using pointer = void;
+   using reference = Array<ElementType>;  // made on the fly, like the rows of std::vector<bool>
+
+   RowIterator() = default;
+   RowIterator(ElementType *memory, size_t width, size_t stride, ptrdiff_t position);
+
+   Array<ElementType> operator*() const;
+   Array<ElementType> operator[](difference_type n) const;
+
+   RowIterator &operator++();
+   RowIterator operator++(int);
+   RowIterator &operator--();
+   RowIterator operator--(int);
+   RowIterator &operator+=(difference_type n);
+   RowIterator &operator-=(difference_type n);
+   RowIterator operator+(difference_type n) const;
+   RowIterator operator-(difference_type n) const;
+   difference_type operator-(RowIterator const &other) const;
+
+   bool operator==(RowIterator const &other) const;
+   bool operator!=(RowIterator const &other) const;
+   bool operator<(RowIterator const &other) const;
+   bool operator>(RowIterator const &other) const;
+   bool operator<=(RowIterator const &other) const;
+   bool operator>=(RowIterator const &other) const;
+
+ private:
+   ElementType *memory = nullptr;  // first row
+   size_t width = 0, stride = 0;
+   ptrdiff_t position = 0;
+};
+
+template <typename ElementType>
+RowIterator<ElementType> operator+(ptrdiff_t n, RowIterator<ElementType> const &iterator);
+
+// Random access iterator over the pixels of a view, row after row, skipping whatever lies between the rows.
+template <typename ElementType>
+class PixelIterator {
+ public:
+   using iterator_category = std::random_access_iterator_tag;
+   using value_type = std::remove_const_t<ElementType>;
+   using difference_type = ptrdiff_t;
+   using pointer = ElementType *;
+   using reference = ElementType &;
+
+   PixelIterator() = default;
+   PixelIterator(ElementType *memory, size_t width, size_t stride, ptrdiff_t position);
+
+   ElementType &operator*() const;
+   ElementType *operator->() const;
+   ElementType &operator[](difference_type n) const;
+
+   PixelIterator &operator++();
+   PixelIterator operator++(int);
+   PixelIterator &operator--();
+   PixelIterator operator--(int);
+   PixelIterator &operator+=(difference_type n);
+   PixelIterator &operator-=(difference_type n);
+   PixelIterator operator+(difference_type n) const;
+   PixelIterator operator-(difference_type n) const;
+   difference_type operator-(PixelIterator const &other) const;
+
+   bool operator==(PixelIterator const &other) const;
+   bool operator!=(PixelIterator const &other) const;
+   bool operator<(PixelIterator const &other) const;
+   bool operator>(PixelIterator const &other) const;
+   bool operator<=(PixelIterator const &other) const;
+   bool operator>=(PixelIterator const &other) const;
+
+ private:
+   // Points pixel at position, which is only needed after a jump; moving by one keeps it up to date on the way.
+   void seek();
+
+   ElementType *memory = nullptr;  // first pixel
+   size_t width = 1, stride = 1;
+   ptrdiff_t position = 0;  // counted as if there were no gaps between the rows
+   ElementType *pixel = nullptr;
+   size_t column = 0;  // of pixel
+};
+
+template <typename ElementType>
+PixelIterator<ElementType> operator+(ptrdiff_t n, PixelIterator<ElementType> const &iterator);
+
+// All pixels of a view as one range, e.g. for the standard algorithms with an execution policy.
+template <typename ElementType>
+class PixelRange {
+ public:
+   using value_type = std::remove_const_t<ElementType>;
+   using iterator = PixelIterator<ElementType>;
+
+   PixelRange(ElementType *memory, size_t height, size_t width, size_t stride);
+
+   PixelIterator<ElementType> begin() const;
+   PixelIterator<ElementType> end() const;
+   size_t size() const;
+
+ private:
+   ElementType *memory;
+   size_t height, width, stride;
+};
+
+template <typename ElementType>
+class Matrix;
+
+// Rectangle of a matrix seen in place, without owning or copying its memory: row i starts stride elements after
+// row i - 1. The memory has to outlive the view. A MatrixView<T const> can only read.
+template <typename ElementType>
+class MatrixView {
+ public:
+   MatrixView(ElementType *memory, size_t height, size_t width, size_t stride);
+   // Views of T can be used as views of T const.
+   template <typename OtherType,
+         typename = std::enable_if_t<std::is_same<ElementType, OtherType const>::value>>
+   MatrixView(MatrixView<OtherType> const &src);
+
+   ElementType *operator[](size_t i) const;
+   // Part of this view, with y and x relative to its top left corner.
+   MatrixView view(size_t y, size_t x, size_t height, size_t width) const;
+   // Whether the rows follow each other without gaps, so that the pixels can be used as one array.
+   bool contiguous() const;
+   Matrix<std::remove_const_t<ElementType>> copy() const;
+   PixelRange<ElementType> pixels() const;
+
+   // A view is also the range of its rows.
+   RowIterator<ElementType> begin() const;
+   RowIterator<ElementType> end() const;
+
+   size_t height, width, stride;
+   ElementType *memory;  // top left element
+};
+
+// Owned memory comes from FramePool, elements are left uninitialized.
 template <typename ElementType>
 class Matrix {
+   static_assert(std::is_trivially_copyable<ElementType>::value, "Matrix copies its elements with memcpy");
+
  public:
    Matrix(size_t height, size_t width);
+   // Wraps existing memory without copying it, owner keeps that memory alive for as long as the matrix needs it.
+   Matrix(size_t height, size_t width, ElementType *memory, std::shared_ptr<void> owner);
+   // Copies are always deep, also of borrowing matrices, so that writing to a copy never changes the original (e.g.
+   // a libfreenect2 buffer or a mapped file). share() gives a matrix using the same memory instead.
    Matrix(const Matrix &src);
-   ~Matrix();
+   Matrix(Matrix &&src) noexcept;
+   ~Matrix() = default;
+
+   Matrix &operator=(const Matrix &src);
+   Matrix &operator=(Matrix &&src) noexcept;
 
    ElementType *operator[](size_t i);
+   ElementType const *operator[](size_t i) const;
    ElementType *data();
    ElementType const *data() const;
 
-   class iterator;
+   bool borrowed() const;
+   // Replaces borrowed memory with a private copy, call before modifying a matrix in place.
+   void make_own();
+   // Returns a matrix borrowing this matrix's memory, which stays alive for as long as either of them needs it.
+   Matrix share() const;
+
+   // Views of the whole matrix or of a part of it, which stay valid until the matrix is destroyed or assigned to.
+   MatrixView<ElementType> view();
+   MatrixView<ElementType const> view() const;
+   MatrixView<ElementType> view(size_t y, size_t x, size_t height, size_t width);
+   MatrixView<ElementType const> view(size_t y, size_t x, size_t height, size_t width) const;
+
+   // All pixels as one range. Unlike those of a view they have no gaps, so plain pointers iterate over them.
+   Array<ElementType> pixels();
+   Array<ElementType const> pixels() const;
+
+   // A matrix is also the range of its rows.
+   using iterator = RowIterator<ElementType>;
+   using const_iterator = RowIterator<ElementType const>;
 
-   Matrix<ElementType>::iterator begin();
-   Matrix<ElementType>::iterator end();
-   Matrix<ElementType>::iterator const begin() const;
-   Matrix<ElementType>::iterator const end() const;
+   iterator begin();
+   iterator end();
+   const_iterator begin() const;
+   const_iterator end() const;
 
-   size_t const height, width;
+   size_t height, width;
 
  private:
-   ElementType *const memory = new ElementType[height * width];
+   static std::shared_ptr<void> allocate(size_t height, size_t width);
+
+   std::shared_ptr<void> owner;
+   ElementType *memory;
+   bool is_borrowed;
+};
+
+// How apply_stencil() reads neighbours which fall outside the source matrix.
+enum class BorderPolicy {
+   SKIP,       // pixels closer to the border than the radius are left untouched in the destination
+   CONSTANT,   // the outside is filled with border_value
+   REPLICATE,  // the nearest pixel of the matrix is repeated: aaa|abcd|ddd
+   REFLECT     // the matrix is mirrored without repeating its edge: dcb|abcd|cba
+};
+
+// Square neighbourhood of 2 * Radius + 1 pixels around one pixel, as passed to the functions of apply_stencil().
+// Elements are read in place through row pointers, nothing is copied for pixels away from the border.
+template <typename ElementType, size_t Radius>
+class Neighbourhood {
+ public:
+   static size_t constexpr size = 2 * Radius + 1;
+
+   // Element dy rows below and dx columns right of the center, with dy and dx in [-Radius, Radius].
+   ElementType const &operator()(ptrdiff_t dy, ptrdiff_t dx) const;
+   ElementType const &center() const;
+
+   ElementType const *rows[size];  // row dy points to row dy - Radius relative to the center
+   size_t column;                  // of the center in rows
+};
+
+// Sets every pixel of the destination to function(neighbourhood), where the neighbourhood is a
+// Neighbourhood<SourceType, Radius> around the same pixel of the source. The source and the destination have to be
+// of the same size and must not overlap. Pixels away from the border are visited in order along rows with the row
+// pointers only moving by one column, so a function which doesn't branch on the values can be vectorized. The border
+// of a view is the view's own, pixels outside of it are never read.
+template <size_t Radius, typename SourceType, typename DestinationType, typename Function>
+void apply_stencil(Matrix<SourceType> const &source, Matrix<DestinationType> &destination, Function const &function,
+      BorderPolicy border = BorderPolicy::REPLICATE, SourceType border_value = SourceType());
+// Views of either T or T const can be the source, the neighbourhoods are Neighbourhood<T, Radius> either way.
+template <size_t Radius, typename SourceType, typename DestinationType, typename Function>
+void apply_stencil(MatrixView<SourceType> source, MatrixView<DestinationType> destination, Function const &function,
+      BorderPolicy border = BorderPolicy::REPLICATE,
+      std::remove_const_t<SourceType> border_value = std::remove_const_t<SourceType>());
+// The same for rows [begin_row, end_row) of the destination only, e.g. to split the work into bands.
+template <size_t Radius, typename SourceType, typename DestinationType, typename Function>
+void apply_stencil_rows(MatrixView<SourceType> source, MatrixView<DestinationType> destination,
+      Function const &function, size_t begin_row, size_t end_row, BorderPolicy border = BorderPolicy::REPLICATE,
+      std::remove_const_t<SourceType> border_value = std::remove_const_t<SourceType>());
+
+// Shared handle to an object which is copied only when written to. Copies of a handle point at the same object;
+// mutate() gives write access, first replacing the object with a private copy if other handles still point at it.
+template <typename ObjectType>
+class CowPtr {
+ public:
+   CowPtr() = default;
+   CowPtr(std::nullptr_t);
+   explicit CowPtr(ObjectType *object);
+
+   ObjectType const *get() const;
+   ObjectType const *operator->() const;
+   ObjectType const &operator*() const;
+   explicit operator bool() const;
+
+   ObjectType *mutate();
+   void reset(ObjectType *new_object = nullptr);
+   long use_count() const;
+
+ private:
+   std::shared_ptr<ObjectType> object;
 };
 
 // Definitions - Array
@@ -90,19 +342,75 @@ ElementType const *Array<ElementType>::end() const {
    return memory + size;
 }
 
+template <typename ElementType>
+ElementType &Array<ElementType>::operator[](size_t const i) {
+   return memory[i];
+}
+
+template <typename ElementType>
+ElementType const &Array<ElementType>::operator[](size_t const i) const {
+   return memory[i];
+}
+
+template <typename ElementType>
+ElementType *Array<ElementType>::data() {
+   return memory;
+}
+
+template <typename ElementType>
+ElementType const *Array<ElementType>::data() const {
+   return memory;
+}
+
 // Definitions - Matrix
 
 template <typename ElementType>
-Matrix<ElementType>::Matrix(size_t const height, size_t const width) : height(height), width(width) {}
+Matrix<ElementType>::Matrix(size_t const height, size_t const width)
+      : height(height), width(width), owner(allocate(height, width)), memory(static_cast<ElementType *>(owner.get())),
+        is_borrowed(false) {}
 
 template <typename ElementType>
-Matrix<ElementType>::Matrix(const Matrix &src) : height(src.height), width(src.width) {
+Matrix<ElementType>::Matrix(
+      size_t const height, size_t const width, ElementType *const memory, std::shared_ptr<void> owner)
+      : height(height), width(width), owner(std::move(owner)), memory(memory), is_borrowed(true) {}
+
+template <typename ElementType>
+Matrix<ElementType>::Matrix(const Matrix &src)
+      : height(src.height), width(src.width), owner(allocate(height, width)),
+        memory(static_cast<ElementType *>(owner.get())), is_borrowed(false) {
    memcpy(memory, src.memory, height * width * sizeof(ElementType));
 }
 
 template <typename ElementType>
-Matrix<ElementType>::~Matrix() {
-   delete[] memory;
+Matrix<ElementType>::Matrix(Matrix &&src) noexcept
+      : height(src.height), width(src.width), owner(std::move(src.owner)), memory(src.memory),
+        is_borrowed(src.is_borrowed) {
+   src.height = 0;
+   src.width = 0;
+   src.memory = nullptr;
+}
+
+template <typename ElementType>
+Matrix<ElementType> &Matrix<ElementType>::operator=(const Matrix &src) {
+   if (this != &src) {
+      *this = Matrix(src);
+   }
+   return *this;
+}
+
+template <typename ElementType>
+Matrix<ElementType> &Matrix<ElementType>::operator=(Matrix &&src) noexcept {
+   if (this != &src) {
+      height = src.height;
+      width = src.width;
+      owner = std::move(src.owner);
+      memory = src.memory;
+      is_borrowed = src.is_borrowed;
+      src.height = 0;
+      src.width = 0;
+      src.memory = nullptr;
+   }
+   return *this;
 }
 
 template <typename ElementType>
@@ -110,6 +418,11 @@ ElementType *Matrix<ElementType>::operator[](size_t const i) {
    return &memory[width * i];
 }
 
+template <typename ElementType>
+ElementType const *Matrix<ElementType>::operator[](size_t const i) const {
+   return &memory[width * i];
+}
+
 template <typename ElementType>
 ElementType *Matrix<ElementType>::data() {
    return memory;
@@ -120,58 +433,547 @@ ElementType const *Matrix<ElementType>::data() const {
    return memory;
 }
 
+template <typename ElementType>
+bool Matrix<ElementType>::borrowed() const {
+   return is_borrowed;
+}
+
+template <typename ElementType>
+void Matrix<ElementType>::make_own() {
+   if (!is_borrowed) {
+      return;
+   }
+   std::shared_ptr<void> own_memory = allocate(height, width);
+   memcpy(own_memory.get(), memory, height * width * sizeof(ElementType));
+   owner = std::move(own_memory);
+   memory = static_cast<ElementType *>(owner.get());
+   is_borrowed = false;
+}
+
+template <typename ElementType>
+Matrix<ElementType> Matrix<ElementType>::share() const {
+   return Matrix(height, width, memory, owner);
+}
+
+template <typename ElementType>
+std::shared_ptr<void> Matrix<ElementType>::allocate(size_t const height, size_t const width) {
+   return FramePool::instance().allocate(height * width * sizeof(ElementType));
+}
+
+template <typename ElementType>
+MatrixView<ElementType> Matrix<ElementType>::view() {
+   return MatrixView<ElementType>(memory, height, width, width);
+}
+
+template <typename ElementType>
+MatrixView<ElementType const> Matrix<ElementType>::view() const {
+   return MatrixView<ElementType const>(memory, height, width, width);
+}
+
+template <typename ElementType>
+MatrixView<ElementType> Matrix<ElementType>::view(
+      size_t const y, size_t const x, size_t const height, size_t const width) {
+   return view().view(y, x, height, width);
+}
+
+template <typename ElementType>
+MatrixView<ElementType const> Matrix<ElementType>::view(
+      size_t const y, size_t const x, size_t const height, size_t const width) const {
+   return view().view(y, x, height, width);
+}
+
+template <typename ElementType>
+Array<ElementType> Matrix<ElementType>::pixels() {
+   return Array<ElementType>(memory, height * width);
+}
+
+template <typename ElementType>
+Array<ElementType const> Matrix<ElementType>::pixels() const {
+   return Array<ElementType const>(memory, height * width);
+}
+
 template <typename ElementType>
 typename Matrix<ElementType>::iterator Matrix<ElementType>::begin() {
-   return iterator(height, width, 0, memory);
+   return view().begin();
 }
 
 template <typename ElementType>
 typename Matrix<ElementType>::iterator Matrix<ElementType>::end() {
-   return iterator(height, width, height, memory);
+   return view().end();
 }
 
 template <typename ElementType>
-typename Matrix<ElementType>::iterator const Matrix<ElementType>::begin() const {
-   return iterator(height, width, 0, memory);
+typename Matrix<ElementType>::const_iterator Matrix<ElementType>::begin() const {
+   return view().begin();
 }
 
 template <typename ElementType>
-typename Matrix<ElementType>::iterator const Matrix<ElementType>::end() const {
-   return iterator(height, width, height, memory);
+typename Matrix<ElementType>::const_iterator Matrix<ElementType>::end() const {
+   return view().end();
 }
 
-// Matrix::iterator
+// Definitions - MatrixView
 
 template <typename ElementType>
-class Matrix<ElementType>::iterator
-      : public std::iterator<std::random_access_iterator_tag, Array<ElementType>, int64_t, void *, Array<ElementType>> {
-   //                    <iterator_category,               value_type,
-   //                    difference_type, pointer, reference>
-   friend Matrix<ElementType>;
-   size_t const height, width;
-   size_t position;
-   ElementType *const memory;
+MatrixView<ElementType>::MatrixView(
+      ElementType *const memory, size_t const height, size_t const width, size_t const stride)
+      : height(height), width(width), stride(stride), memory(memory) {
+   if (stride < width) {
+      throw std::invalid_argument("MatrixView rows can't be longer than its stride");
+   }
+}
 
- public:
-   explicit iterator(size_t const height, size_t const width, size_t const position, ElementType *const memory)
-         : height(height), width(width), position(position), memory(memory) {}
+template <typename ElementType>
+template <typename OtherType, typename>
+MatrixView<ElementType>::MatrixView(MatrixView<OtherType> const &src)
+      : height(src.height), width(src.width), stride(src.stride), memory(src.memory) {}
+
+template <typename ElementType>
+ElementType *MatrixView<ElementType>::operator[](size_t const i) const {
+   return memory + stride * i;
+}
 
-   bool operator==(iterator const &b) {
-      return b.position == position;
+template <typename ElementType>
+MatrixView<ElementType> MatrixView<ElementType>::view(
+      size_t const y, size_t const x, size_t const height, size_t const width) const {
+   if (y > this->height || height > this->height - y || x > this->width || width > this->width - x) {
+      throw std::out_of_range("MatrixView::view() got a rectangle which doesn't fit in the view");
    }
+   return MatrixView(memory + stride * y + x, height, width, stride);
+}
 
-   bool operator!=(iterator const &b) {
-      return !(*this == b);
+template <typename ElementType>
+bool MatrixView<ElementType>::contiguous() const {
+   return stride == width || height <= 1;
+}
+
+template <typename ElementType>
+Matrix<std::remove_const_t<ElementType>> MatrixView<ElementType>::copy() const {
+   Matrix<std::remove_const_t<ElementType>> result(height, width);
+   for (size_t i = 0; i < height; ++i) {
+      memcpy(result[i], (*this)[i], width * sizeof(ElementType));
    }
+   return result;
+}
+
+template <typename ElementType>
+PixelRange<ElementType> MatrixView<ElementType>::pixels() const {
+   return PixelRange<ElementType>(memory, height, width, stride);
+}
+
+template <typename ElementType>
+RowIterator<ElementType> MatrixView<ElementType>::begin() const {
+   return RowIterator<ElementType>(memory, width, stride, 0);
+}
 
-   Array<ElementType> operator*() {
-      return Array<ElementType>(memory + width * position, width);
+template <typename ElementType>
+RowIterator<ElementType> MatrixView<ElementType>::end() const {
+   return RowIterator<ElementType>(memory, width, stride, static_cast<ptrdiff_t>(height));
+}
+
+// Definitions - RowIterator
+
+template <typename ElementType>
+RowIterator<ElementType>::RowIterator(
+      ElementType *const memory, size_t const width, size_t const stride, ptrdiff_t const position)
+      : memory(memory), width(width), stride(stride), position(position) {}
+
+template <typename ElementType>
+Array<ElementType> RowIterator<ElementType>::operator*() const {
+   return Array<ElementType>(memory + static_cast<ptrdiff_t>(stride) * position, width);
+}
+
+template <typename ElementType>
+Array<ElementType> RowIterator<ElementType>::operator[](difference_type const n) const {
+   return *(*this + n);
+}
+
+template <typename ElementType>
+RowIterator<ElementType> &RowIterator<ElementType>::operator++() {
+   ++position;
+   return *this;
+}
+
+template <typename ElementType>
+RowIterator<ElementType> RowIterator<ElementType>::operator++(int) {
+   RowIterator result = *this;
+   ++position;
+   return result;
+}
+
+template <typename ElementType>
+RowIterator<ElementType> &RowIterator<ElementType>::operator--() {
+   --position;
+   return *this;
+}
+
+template <typename ElementType>
+RowIterator<ElementType> RowIterator<ElementType>::operator--(int) {
+   RowIterator result = *this;
+   --position;
+   return result;
+}
+
+template <typename ElementType>
+RowIterator<ElementType> &RowIterator<ElementType>::operator+=(difference_type const n) {
+   position += n;
+   return *this;
+}
+
+template <typename ElementType>
+RowIterator<ElementType> &RowIterator<ElementType>::operator-=(difference_type const n) {
+   position -= n;
+   return *this;
+}
+
+template <typename ElementType>
+RowIterator<ElementType> RowIterator<ElementType>::operator+(difference_type const n) const {
+   return RowIterator(memory, width, stride, position + n);
+}
+
+template <typename ElementType>
+RowIterator<ElementType> RowIterator<ElementType>::operator-(difference_type const n) const {
+   return RowIterator(memory, width, stride, position - n);
+}
+
+template <typename ElementType>
+ptrdiff_t RowIterator<ElementType>::operator-(RowIterator const &other) const {
+   return position - other.position;
+}
+
+template <typename ElementType>
+bool RowIterator<ElementType>::operator==(RowIterator const &other) const {
+   return position == other.position;
+}
+
+template <typename ElementType>
+bool RowIterator<ElementType>::operator!=(RowIterator const &other) const {
+   return position != other.position;
+}
+
+template <typename ElementType>
+bool RowIterator<ElementType>::operator<(RowIterator const &other) const {
+   return position < other.position;
+}
+
+template <typename ElementType>
+bool RowIterator<ElementType>::operator>(RowIterator const &other) const {
+   return position > other.position;
+}
+
+template <typename ElementType>
+bool RowIterator<ElementType>::operator<=(RowIterator const &other) const {
+   return position <= other.position;
+}
+
+template <typename ElementType>
+bool RowIterator<ElementType>::operator>=(RowIterator const &other) const {
+   return position >= other.position;
+}
+
+template <typename ElementType>
+RowIterator<ElementType> operator+(ptrdiff_t const n, RowIterator<ElementType> const &iterator) {
+   return iterator + n;
+}
+
+// Definitions - PixelIterator
+
+template <typename ElementType>
+PixelIterator<ElementType>::PixelIterator(
+      ElementType *const memory, size_t const width, size_t const stride, ptrdiff_t const position)
+      : memory(memory), width(std::max<size_t>(width, 1)), stride(stride), position(position) {
+   seek();
+}
+
+template <typename ElementType>
+void PixelIterator<ElementType>::seek() {
+   // Past the end and before the beginning only need to compare right, they're never dereferenced.
+   auto const index = static_cast<size_t>(std::max<ptrdiff_t>(position, 0));
+   column = index % width;
+   pixel = memory + index / width * stride + column;
+}
+
+template <typename ElementType>
+ElementType &PixelIterator<ElementType>::operator*() const {
+   return *pixel;
+}
+
+template <typename ElementType>
+ElementType *PixelIterator<ElementType>::operator->() const {
+   return pixel;
+}
+
+template <typename ElementType>
+ElementType &PixelIterator<ElementType>::operator[](difference_type const n) const {
+   return *(*this + n);
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> &PixelIterator<ElementType>::operator++() {
+   ++position;
+   ++pixel;
+   if (++column == width) {
+      column = 0;
+      pixel += stride - width;
    }
+   return *this;
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> PixelIterator<ElementType>::operator++(int) {
+   PixelIterator result = *this;
+   ++*this;
+   return result;
+}
 
-   iterator &operator++() {
-      position += 1;
-      return *this;
+template <typename ElementType>
+PixelIterator<ElementType> &PixelIterator<ElementType>::operator--() {
+   return *this -= 1;
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> PixelIterator<ElementType>::operator--(int) {
+   PixelIterator result = *this;
+   --*this;
+   return result;
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> &PixelIterator<ElementType>::operator+=(difference_type const n) {
+   position += n;
+   // Algorithms unroll their loops by indexing a few pixels ahead, which mostly stays within the row.
+   auto const new_column = static_cast<ptrdiff_t>(column) + n;
+   if (position >= 0 && new_column >= 0 && new_column < static_cast<ptrdiff_t>(width)) {
+      column = static_cast<size_t>(new_column);
+      pixel += n;
+   } else {
+      seek();
    }
-};
+   return *this;
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> &PixelIterator<ElementType>::operator-=(difference_type const n) {
+   return *this += -n;
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> PixelIterator<ElementType>::operator+(difference_type const n) const {
+   return PixelIterator(memory, width, stride, position + n);
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> PixelIterator<ElementType>::operator-(difference_type const n) const {
+   return PixelIterator(memory, width, stride, position - n);
+}
+
+template <typename ElementType>
+ptrdiff_t PixelIterator<ElementType>::operator-(PixelIterator const &other) const {
+   return position - other.position;
+}
+
+template <typename ElementType>
+bool PixelIterator<ElementType>::operator==(PixelIterator const &other) const {
+   return position == other.position;
+}
+
+template <typename ElementType>
+bool PixelIterator<ElementType>::operator!=(PixelIterator const &other) const {
+   return position != other.position;
+}
+
+template <typename ElementType>
+bool PixelIterator<ElementType>::operator<(PixelIterator const &other) const {
+   return position < other.position;
+}
+
+template <typename ElementType>
+bool PixelIterator<ElementType>::operator>(PixelIterator const &other) const {
+   return position > other.position;
+}
+
+template <typename ElementType>
+bool PixelIterator<ElementType>::operator<=(PixelIterator const &other) const {
+   return position <= other.position;
+}
+
+template <typename ElementType>
+bool PixelIterator<ElementType>::operator>=(PixelIterator const &other) const {
+   return position >= other.position;
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> operator+(ptrdiff_t const n, PixelIterator<ElementType> const &iterator) {
+   return iterator + n;
+}
+
+// Definitions - PixelRange
+
+template <typename ElementType>
+PixelRange<ElementType>::PixelRange(
+      ElementType *const memory, size_t const height, size_t const width, size_t const stride)
+      : memory(memory), height(height), width(width), stride(stride) {}
+
+template <typename ElementType>
+PixelIterator<ElementType> PixelRange<ElementType>::begin() const {
+   return PixelIterator<ElementType>(memory, width, stride, 0);
+}
+
+template <typename ElementType>
+PixelIterator<ElementType> PixelRange<ElementType>::end() const {
+   return PixelIterator<ElementType>(memory, width, stride, static_cast<ptrdiff_t>(size()));
+}
+
+template <typename ElementType>
+size_t PixelRange<ElementType>::size() const {
+   return height * width;
+}
+
+// Definitions - stencils
+
+template <typename ElementType, size_t Radius>
+ElementType const &Neighbourhood<ElementType, Radius>::operator()(ptrdiff_t const dy, ptrdiff_t const dx) const {
+   return rows[static_cast<ptrdiff_t>(Radius) + dy][static_cast<ptrdiff_t>(column) + dx];
+}
+
+template <typename ElementType, size_t Radius>
+ElementType const &Neighbourhood<ElementType, Radius>::center() const {
+   return rows[Radius][column];
+}
+
+// Index inside [0, size) which the border policy reads for index, or -1 for CONSTANT outside the matrix.
+ptrdiff_t border_index(ptrdiff_t index, ptrdiff_t const size, BorderPolicy const border) {
+   if (index >= 0 && index < size) {
+      return index;
+   }
+   switch (border) {
+      case BorderPolicy::REPLICATE:
+         return std::min(std::max<ptrdiff_t>(index, 0), size - 1);
+      case BorderPolicy::REFLECT:
+         if (size == 1) {
+            return 0;
+         }
+         // Radii larger than the matrix can need several reflections.
+         while (index < 0 || index >= size) {
+            index = index < 0 ? -index : 2 * (size - 1) - index;
+         }
+         return index;
+      default:
+         return -1;
+   }
+}
+
+template <size_t Radius, typename SourceType, typename DestinationType, typename Function>
+void apply_stencil(Matrix<SourceType> const &source, Matrix<DestinationType> &destination, Function const &function,
+      BorderPolicy const border, SourceType const border_value) {
+   apply_stencil<Radius>(source.view(), destination.view(), function, border, border_value);
+}
+
+template <size_t Radius, typename SourceType, typename DestinationType, typename Function>
+void apply_stencil(MatrixView<SourceType> const source, MatrixView<DestinationType> const destination,
+      Function const &function, BorderPolicy const border, std::remove_const_t<SourceType> const border_value) {
+   apply_stencil_rows<Radius>(source, destination, function, 0, destination.height, border, border_value);
+}
+
+template <size_t Radius, typename SourceType, typename DestinationType, typename Function>
+void apply_stencil_rows(MatrixView<SourceType> const source, MatrixView<DestinationType> const destination,
+      Function const &function, size_t const begin_row, size_t const end_row, BorderPolicy const border,
+      std::remove_const_t<SourceType> const border_value) {
+   using Window = Neighbourhood<std::remove_const_t<SourceType>, Radius>;
+   if (source.height != destination.height || source.width != destination.width) {
+      throw std::invalid_argument("apply_stencil() needs a source and a destination of the same size");
+   }
+   size_t const height = source.height, width = source.width;
+   bool const interior_rows = height > 2 * Radius, interior_columns = width > 2 * Radius;
+
+   // Pixels near the border see a copy of their neighbourhood made according to the policy.
+   std::remove_const_t<SourceType> patch[Window::size][Window::size];
+   Window patch_window;
+   for (size_t k = 0; k < Window::size; ++k) {
+      patch_window.rows[k] = patch[k];
+   }
+   patch_window.column = Radius;
+   auto border_pixel = [&](size_t const i, size_t const j) {
+      if (border == BorderPolicy::SKIP) {
+         return;
+      }
+      for (size_t k = 0; k < Window::size; ++k) {
+         ptrdiff_t const y = border_index(ptrdiff_t(i + k) - ptrdiff_t(Radius), ptrdiff_t(height), border);
+         for (size_t l = 0; l < Window::size; ++l) {
+            ptrdiff_t const x = border_index(ptrdiff_t(j + l) - ptrdiff_t(Radius), ptrdiff_t(width), border);
+            patch[k][l] = y < 0 || x < 0 ? border_value : source[size_t(y)][size_t(x)];
+         }
+      }
+      destination[i][j] = function(static_cast<Window const &>(patch_window));
+   };
+
+   for (size_t i = begin_row; i < std::min(end_row, height); ++i) {
+      if (!interior_rows || !interior_columns || i < Radius || i >= height - Radius) {
+         for (size_t j = 0; j < width; ++j) {
+            border_pixel(i, j);
+         }
+         continue;
+      }
+      for (size_t j = 0; j < Radius; ++j) {
+         border_pixel(i, j);
+         border_pixel(i, width - 1 - j);
+      }
+      Window window;
+      for (size_t k = 0; k < Window::size; ++k) {
+         window.rows[k] = source[i + k - Radius];
+      }
+      DestinationType *const destination_row = destination[i];
+      for (size_t j = Radius; j < width - Radius; ++j) {
+         window.column = j;
+         destination_row[j] = function(static_cast<Window const &>(window));
+      }
+   }
+}
+
+// Definitions - CowPtr
+
+template <typename ObjectType>
+CowPtr<ObjectType>::CowPtr(std::nullptr_t) {}
+
+template <typename ObjectType>
+CowPtr<ObjectType>::CowPtr(ObjectType *const object) : object(object) {}
+
+template <typename ObjectType>
+ObjectType const *CowPtr<ObjectType>::get() const {
+   return object.get();
+}
+
+template <typename ObjectType>
+ObjectType const *CowPtr<ObjectType>::operator->() const {
+   return object.get();
+}
+
+template <typename ObjectType>
+ObjectType const &CowPtr<ObjectType>::operator*() const {
+   return *object;
+}
+
+template <typename ObjectType>
+CowPtr<ObjectType>::operator bool() const {
+   return object != nullptr;
+}
+
+template <typename ObjectType>
+ObjectType *CowPtr<ObjectType>::mutate() {
+   if (object.use_count() > 1) {
+      object = std::make_shared<ObjectType>(*object);
+   }
+   return object.get();
+}
+
+template <typename ObjectType>
+void CowPtr<ObjectType>::reset(ObjectType *const new_object) {
+   object.reset(new_object);
+}
+
+template <typename ObjectType>
+long CowPtr<ObjectType>::use_count() const {
+   return object.use_count();
+}
 
 #endif
@@ -0,0 +1,158 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BITMAP_PANEL_HPP
+#define BITMAP_PANEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <wx/bitmap.h>
+#include <wx/dcclient.h>
+#include <wx/event.h>
+#include <wx/panel.h>
+#include <wx/rawbmp.h>
+#include <wx/wx.h>
+
+#include "basic_types.hpp"
+#include "parallel.hpp"
+
+// Constants
+
+wxDEFINE_EVENT(REFRESH_BITMAP_PANEL_EVENT, wxCommandEvent);
+
+// Declarations
+
+// One pixel of the RGB buffers passed to show_pixels().
+struct BitmapPixel {
+   uint8_t red, green, blue;
+};
+static_assert(sizeof(BitmapPixel) == 3, "BitmapPixel must match the layout of the RGB buffers");
+
+// The top left width x height pixels of an RGB buffer bitmap_width pixels wide, e.g. as the destination of evaluate().
+MatrixView<BitmapPixel> bitmap_view(uint8_t *bitmap, size_t bitmap_width, size_t height, size_t width);
+
+// Panel showing RGB pixels through one bitmap kept for its whole life. New pixels are copied into the bitmap when
+// the panel is repainted, so pixels shown several times between repaints are only copied once.
+class BitmapPanel : public wxPanel {
+ public:
+   BitmapPanel(wxWindow *parent, wxWindowID window_id, int width, int height);
+
+   // Can be called from any thread. Makes the UI thread call refresh_display(); requests made before it gets to
+   // them are merged into one.
+   void request_refresh();
+
+ protected:
+   // Called on the UI thread, should call show_pixels() if there is something new to show.
+   virtual void refresh_display() = 0;
+   // Shows width x height RGB pixels, each drawn as a scale x scale square. The pixels aren't copied until the next
+   // repaint, so they have to stay unchanged until then or until show_pixels() is called again.
+   void show_pixels(uint8_t const *pixels, size_t width, size_t height, size_t scale = 1);
+
+ private:
+   void on_refresh_event(wxCommandEvent &event);
+   void on_paint(wxPaintEvent &event);
+   void copy_to_bitmap();
+
+   wxBitmap bitmap;
+   std::atomic<bool> refresh_pending{false};
+   bool dirty = true;
+   uint8_t const *pending_pixels = nullptr;  // nullptr means black
+   size_t pending_width = 0, pending_height = 0, pending_scale = 1;
+};
+
+// Definitions
+
+MatrixView<BitmapPixel> bitmap_view(
+      uint8_t *const bitmap, size_t const bitmap_width, size_t const height, size_t const width) {
+   return MatrixView<BitmapPixel>(reinterpret_cast<BitmapPixel *>(bitmap), height, width, bitmap_width);
+}
+
+BitmapPanel::BitmapPanel(wxWindow *parent, wxWindowID window_id, int width, int height)
+      : wxPanel(parent, window_id, wxPoint(0, 0), wxSize(width, height), wxBORDER_SUNKEN), bitmap(width, height, 24) {
+   // The whole panel is drawn by on_paint(), there is no need to erase it first.
+   SetBackgroundStyle(wxBG_STYLE_PAINT);
+   Bind(REFRESH_BITMAP_PANEL_EVENT, &BitmapPanel::on_refresh_event, this);
+   Bind(wxEVT_PAINT, &BitmapPanel::on_paint, this);
+}
+
+void BitmapPanel::request_refresh() {
+   if (!refresh_pending.exchange(true)) {
+      wxPostEvent(this, wxCommandEvent(REFRESH_BITMAP_PANEL_EVENT));
+   }
+}
+
+void BitmapPanel::show_pixels(uint8_t const *pixels, size_t width, size_t height, size_t scale) {
+   pending_pixels = pixels;
+   pending_width = width;
+   pending_height = height;
+   pending_scale = std::max<size_t>(scale, 1);
+   dirty = true;
+   Refresh(false);
+}
+
+void BitmapPanel::on_refresh_event(wxCommandEvent &event) {
+   // Cleared first, so that a request made while refreshing gets its own event.
+   refresh_pending = false;
+   refresh_display();
+}
+
+void BitmapPanel::on_paint(wxPaintEvent &event) {
+   if (dirty) {
+      copy_to_bitmap();
+      dirty = false;
+   }
+   wxPaintDC dc(this);
+   dc.DrawBitmap(bitmap, 0, 0);
+}
+
+void BitmapPanel::copy_to_bitmap() {
+   wxNativePixelData data(bitmap);
+   if (!data) {
+      return;
+   }
+   auto const width = static_cast<size_t>(data.GetWidth()), height = static_cast<size_t>(data.GetHeight());
+   size_t const shown_width = std::min(width, pending_width * pending_scale);
+   size_t const shown_height = std::min(height, pending_height * pending_scale);
+   parallel_for_rows(height, [&](size_t const begin, size_t const end) {
+      wxNativePixelData::Iterator row_start(data);
+      row_start.OffsetY(data, static_cast<int>(begin));
+      for (size_t i = begin; i < end; ++i) {
+         wxNativePixelData::Iterator pixel = row_start;
+         size_t j = 0;
+         if (pending_pixels != nullptr && i < shown_height) {
+            uint8_t const *source_row = pending_pixels + 3 * (i / pending_scale) * pending_width;
+            for (; j < shown_width; ++j, ++pixel) {
+               uint8_t const *source = source_row + 3 * (j / pending_scale);
+               pixel.Red() = source[0];
+               pixel.Green() = source[1];
+               pixel.Blue() = source[2];
+            }
+         }
+         for (; j < width; ++j, ++pixel) {
+            pixel.Red() = pixel.Green() = pixel.Blue() = 0;
+         }
+         row_start.OffsetY(data, 1);
+      }
+   });
+}
+
+#endif
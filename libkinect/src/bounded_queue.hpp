@@ -0,0 +1,148 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+// Declarations
+
+// What to do when an element is pushed into a full queue.
+enum class OverflowPolicy {
+   DROP_OLDEST,  // discard the element at the front of the queue to make room
+   DROP_NEWEST,  // discard the element being pushed
+   BLOCK         // wait until a consumer makes room
+};
+
+// Multi-producer, multi-consumer FIFO queue with a fixed capacity.
+template <typename ElementType>
+class BoundedQueue {
+ public:
+   BoundedQueue(size_t capacity, OverflowPolicy overflow_policy);
+
+   // Returns false if an element had to be dropped (or the queue is closed).
+   bool push(ElementType element);
+   // Blocks until an element is available. Returns false once the queue is closed.
+   bool pop(ElementType &element);
+   // Wakes up all waiting producers and consumers, elements still queued are discarded.
+   void close();
+
+   size_t size() const;
+   uint64_t pushed() const;
+   uint64_t dropped() const;
+
+   size_t const capacity;
+   OverflowPolicy const overflow_policy;
+
+ private:
+   mutable std::mutex mutex;
+   std::condition_variable not_empty, not_full;
+   std::deque<ElementType> elements;
+   bool closed = false;
+   uint64_t pushed_count = 0, dropped_count = 0;
+};
+
+// Definitions
+
+template <typename ElementType>
+BoundedQueue<ElementType>::BoundedQueue(size_t const capacity, OverflowPolicy const overflow_policy)
+      : capacity(capacity), overflow_policy(overflow_policy) {
+   if (capacity == 0) {
+      throw std::invalid_argument("BoundedQueue capacity must be positive");
+   }
+}
+
+template <typename ElementType>
+bool BoundedQueue<ElementType>::push(ElementType element) {
+   std::unique_lock<std::mutex> lock(mutex);
+   bool dropped_any = false;
+   if (elements.size() >= capacity && !closed) {
+      if (overflow_policy == OverflowPolicy::BLOCK) {
+         not_full.wait(lock, [this] { return elements.size() < capacity || closed; });
+      } else if (overflow_policy == OverflowPolicy::DROP_OLDEST) {
+         elements.pop_front();
+         ++dropped_count;
+         dropped_any = true;
+      } else {
+         ++dropped_count;
+         return false;
+      }
+   }
+   if (closed) {
+      ++dropped_count;
+      return false;
+   }
+   elements.push_back(std::move(element));
+   ++pushed_count;
+   lock.unlock();
+   not_empty.notify_one();
+   return !dropped_any;
+}
+
+template <typename ElementType>
+bool BoundedQueue<ElementType>::pop(ElementType &element) {
+   std::unique_lock<std::mutex> lock(mutex);
+   not_empty.wait(lock, [this] { return !elements.empty() || closed; });
+   if (closed) {
+      return false;
+   }
+   element = std::move(elements.front());
+   elements.pop_front();
+   lock.unlock();
+   not_full.notify_one();
+   return true;
+}
+
+template <typename ElementType>
+void BoundedQueue<ElementType>::close() {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      dropped_count += elements.size();
+      elements.clear();
+   }
+   not_empty.notify_all();
+   not_full.notify_all();
+}
+
+template <typename ElementType>
+size_t BoundedQueue<ElementType>::size() const {
+   std::lock_guard<std::mutex> lock(mutex);
+   return elements.size();
+}
+
+template <typename ElementType>
+uint64_t BoundedQueue<ElementType>::pushed() const {
+   std::lock_guard<std::mutex> lock(mutex);
+   return pushed_count;
+}
+
+template <typename ElementType>
+uint64_t BoundedQueue<ElementType>::dropped() const {
+   std::lock_guard<std::mutex> lock(mutex);
+   return dropped_count;
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "basic_types.hpp"
+#include "picture.hpp"
+#include "recording.hpp"
+
+// Writes through mutate() on a copy of the picture and checks that the original frame's pixels stay as they were.
+// Returns false and explains why if they don't.
+bool check_mutate(std::string const &name, Picture const &original) {
+   float const before = original.depth_frame->float_pixels()[0][0];
+   Picture copy = original;
+   copy.depth_frame.mutate()->visit_pixels([](auto &pixels) { pixels[0][0] += 1; });
+   bool const unchanged = original.depth_frame->float_pixels()[0][0] == before;
+   bool const written = copy.depth_frame->float_pixels()[0][0] == before + 1.0f;
+   std::cout << name << ": " << (unchanged && written ? "ok" : "FAILED") << "\n";
+   if (!unchanged) {
+      std::cerr << "  writing to the copy changed the original's pixels\n";
+   }
+   if (!written) {
+      std::cerr << "  the copy did not get the written value\n";
+   }
+   return unchanged && written;
+}
+
+int main() {
+   size_t const height = 424, width = 512;
+   bool ok = true;
+
+   // A matrix borrowing memory it doesn't own, as Kinect v2 frames borrow libfreenect2's buffers.
+   auto buffer = std::make_shared<std::vector<float>>(height * width, 1000.0f);
+   Picture borrowed;
+   borrowed.depth_frame.reset(
+         new Picture::DepthOrIrFrame(new Matrix<float>(height, width, buffer->data(), buffer), true));
+   ok = check_mutate("Frame borrowing a buffer", borrowed) && ok;
+   if ((*buffer)[0] != 1000.0f) {
+      std::cerr << "  the borrowed buffer was written to\n";
+      ok = false;
+   }
+
+   // Frames of a recording borrow its mapping, which other pictures read too.
+   char recording_filename[] = "/tmp/copy_on_write_check_XXXXXX";
+   int const descriptor = mkstemp(recording_filename);
+   if (descriptor < 0) {
+      std::cerr << "Could not create a temporary file\n";
+      return 1;
+   }
+   close(descriptor);
+   {
+      RecordingWriter writer(recording_filename, 2);
+      writer.append(borrowed);
+   }
+   {
+      RecordingReader reader(recording_filename);
+      Picture mapped = reader.frame(0);
+      Picture other = reader.frame(0);
+      ok = check_mutate("Frame of a mapped recording", mapped) && ok;
+      if (other.depth_frame->float_pixels()[0][0] != 1000.0f) {
+         std::cerr << "  another picture of the same recording frame was changed\n";
+         ok = false;
+      }
+   }
+   std::remove(recording_filename);
+
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "basic_types.hpp"
+#include "depth_codec.hpp"
+#include "picture.hpp"
+#include "synthetic_source.hpp"
+
+struct FrameSet {
+   std::string name;
+   std::vector<Picture::DepthOrIrFrame> frames;
+};
+
+struct Totals {
+   double raw_bytes = 0.0, gzip_bytes = 0.0, codec_bytes = 0.0;
+   double gzip_encode_ms = 0.0, gzip_decode_ms = 0.0, codec_encode_ms = 0.0, codec_decode_ms = 0.0;
+};
+
+// Runs the function repeatedly for at least a tenth of a second and returns the average time of one run in
+// milliseconds.
+double time_per_run(std::function<void()> const &function) {
+   using clock = std::chrono::steady_clock;
+   size_t runs = 0;
+   auto start = clock::now();
+   do {
+      function();
+      ++runs;
+   } while (clock::now() - start < std::chrono::milliseconds(100));
+   return std::chrono::duration<double, std::milli>(clock::now() - start).count() / runs;
+}
+
+// The frame's pixels in the layout of an uncompressed file, which save_to_file() gzips.
+template <typename ElementType>
+std::vector<uint8_t> raw_bytes(Matrix<ElementType> const &pixels) {
+   std::vector<uint8_t> bytes(pixels.height * pixels.width * sizeof(ElementType));
+   memcpy(bytes.data(), pixels.data(), bytes.size());
+   return bytes;
+}
+
+template <typename ElementType>
+void measure_frame(Matrix<ElementType> const &pixels, Totals &totals) {
+   auto const raw = raw_bytes(pixels);
+
+   // Deflate at zlib's default level, as gzopen(..., "w") does.
+   std::vector<uint8_t> gzipped(compressBound(static_cast<uLong>(raw.size())));
+   uLongf gzip_size = 0;
+   totals.gzip_encode_ms += time_per_run([&] {
+      gzip_size = static_cast<uLongf>(gzipped.size());
+      if (compress2(gzipped.data(), &gzip_size, raw.data(), static_cast<uLong>(raw.size()), Z_DEFAULT_COMPRESSION)
+            != Z_OK) {
+         throw std::runtime_error("compress2() failed");
+      }
+   });
+   std::vector<uint8_t> inflated(raw.size());
+   totals.gzip_decode_ms += time_per_run([&] {
+      auto inflated_size = static_cast<uLongf>(inflated.size());
+      if (uncompress(inflated.data(), &inflated_size, gzipped.data(), gzip_size) != Z_OK) {
+         throw std::runtime_error("uncompress() failed");
+      }
+   });
+
+   EncodedDepth encoded;
+   totals.codec_encode_ms += time_per_run([&] { encoded = depth_codec_encode(pixels.view()); });
+   Matrix<ElementType> decoded(pixels.height, pixels.width);
+   totals.codec_decode_ms += time_per_run(
+         [&] { depth_codec_decode(encoded.bytes.data(), encoded.bytes.size(), encoded.samples, decoded.view()); });
+   if (memcmp(decoded.data(), pixels.data(), raw.size()) != 0) {
+      throw std::runtime_error("The depth codec did not give back the same pixels");
+   }
+
+   totals.raw_bytes += double(raw.size());
+   totals.gzip_bytes += double(gzip_size);
+   totals.codec_bytes += double(encoded.bytes.size());
+}
+
+void report(FrameSet const &set) {
+   Totals totals;
+   for (auto const &frame : set.frames) {
+      frame.visit_pixels([&](auto const &pixels) { measure_frame(pixels, totals); });
+   }
+   auto const frames = double(set.frames.size());
+   std::cout << set.name << " (" << set.frames.size() << " frames):\n"
+             << "  gzip:  ratio " << totals.raw_bytes / totals.gzip_bytes << ", encode "
+             << totals.gzip_encode_ms / frames << " ms/frame, decode " << totals.gzip_decode_ms / frames
+             << " ms/frame\n"
+             << "  codec: ratio " << totals.raw_bytes / totals.codec_bytes << ", encode "
+             << totals.codec_encode_ms / frames << " ms/frame, decode " << totals.codec_decode_ms / frames
+             << " ms/frame\n"
+             << "  codec vs gzip: " << totals.gzip_bytes / totals.codec_bytes << "x smaller, "
+             << totals.gzip_encode_ms / totals.codec_encode_ms << "x faster to encode, "
+             << totals.gzip_decode_ms / totals.codec_decode_ms << "x faster to decode\n\n";
+}
+
+// Depth and IR frames of a synthetic scene. With round_to_whole, float pixels are rounded as if the frames were saved
+// in whole millimetres.
+std::vector<FrameSet> synthetic_sets(
+      std::string const &name, SyntheticSettings const &settings, bool const round_to_whole = false) {
+   SyntheticSource source(settings);
+   FrameSet depth{name + ", depth", {}}, ir{name + ", IR", {}};
+   for (uint64_t n = 0; n < 10; ++n) {
+      Picture picture = source.generate(n * 7, false, true, true);
+      depth.frames.push_back(*picture.depth_frame);
+      ir.frames.push_back(*picture.ir_frame);
+   }
+   if (round_to_whole) {
+      for (auto *set : {&depth, &ir}) {
+         for (auto &frame : set->frames) {
+            frame.visit_pixels([](auto &pixels) {
+               for (auto &pixel : pixels.pixels()) {
+                  pixel = std::round(pixel);
+               }
+            });
+         }
+      }
+   }
+   return {depth, ir};
+}
+
+int main(int argc, char *argv[]) {
+   std::vector<FrameSet> sets;
+   if (argc > 1) {
+      FrameSet files{"Files given as arguments", {}};
+      for (int i = 1; i < argc; ++i) {
+         files.frames.emplace_back(std::string(argv[i]));
+      }
+      sets.push_back(files);
+   } else {
+      std::cout << "Measuring on synthetic frames, depth or IR files can be given as arguments instead\n\n";
+      SyntheticSettings settings;
+      settings.scene = SyntheticScene::FACE;
+      for (auto &set : synthetic_sets("Kinect v2 face", settings)) {
+         sets.push_back(set);
+      }
+      for (auto &set : synthetic_sets("Kinect v2 face in whole millimetres", settings, true)) {
+         sets.push_back(set);
+      }
+      settings.scene = SyntheticScene::SPHERES;
+      settings.sphere_count = 3;
+      for (auto &set : synthetic_sets("Kinect v2 spheres", settings)) {
+         sets.push_back(set);
+      }
+      settings.which_kinect = 1;
+      settings.depth_width = 640;
+      settings.depth_height = 480;
+      for (auto &set : synthetic_sets("Kinect v1 spheres", settings)) {
+         sets.push_back(set);
+      }
+   }
+   for (auto const &set : sets) {
+      report(set);
+   }
+   return 0;
+}
@@ -0,0 +1,156 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEPTH_RENDERER_HPP
+#define DEPTH_RENDERER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "basic_types.hpp"
+#include "parallel.hpp"
+#include "picture.hpp"
+
+// Declarations
+
+enum class Colormap {
+   RAINBOW,   // cv::COLORMAP_RAINBOW, used for depth
+   GRAYSCALE  // used for IR
+};
+
+// Renders depth or IR frames into RGB display bitmaps in one pass. Values between the minimum and the maximum of
+// the range are mapped to colors through a table with an entry for every integer value of the range, which is only
+// rebuilt when the range changes. Values outside the range get the color of the nearest end.
+class DepthRenderer {
+ public:
+   explicit DepthRenderer(Colormap colormap = Colormap::RAINBOW);
+
+   // Returns true if the table had to be rebuilt. A range narrower than 1 is widened to 1.
+   bool set_range(float min_value, float max_value);
+   // Writes the frame's pixels as RGB into the top left corner of a bitmap bitmap_width pixels wide. With step > 1
+   // only every step-th pixel of every step-th row is rendered, giving a preview (width + step - 1) / step wide.
+   void render(Picture::DepthOrIrFrame const &frame, uint8_t *bitmap, size_t bitmap_width, size_t step = 1) const;
+   template <typename T>
+   void render(Matrix<T> const &pixels, uint8_t *bitmap, size_t bitmap_width, size_t step = 1) const;
+   // E.g. a part of a frame.
+   template <typename T>
+   void render(MatrixView<T const> pixels, uint8_t *bitmap, size_t bitmap_width, size_t step = 1) const;
+
+   Colormap const colormap;
+
+ private:
+   template <typename T>
+   size_t table_index(T value) const;
+
+   uint8_t palette[256][3];  // RGB
+   // RGB of each integer value of the range, padded to 4 bytes so that a pixel can be written with one store.
+   std::vector<uint32_t> table;
+   float min_value = 0.0f, max_value = 0.0f;
+};
+
+// Definitions
+
+DepthRenderer::DepthRenderer(Colormap const colormap) : colormap(colormap) {
+   if (colormap == Colormap::RAINBOW) {
+      // Asking OpenCV for the colors of all 256 levels keeps the display identical to cv::applyColorMap.
+      cv::Mat levels(cv::Size(256, 1), CV_8UC1), colors(cv::Size(256, 1), CV_8UC3);
+      for (int i = 0; i < 256; ++i) {
+         levels.at<uint8_t>(0, i) = static_cast<uint8_t>(i);
+      }
+      cv::applyColorMap(levels, colors, cv::COLORMAP_RAINBOW);
+      for (int i = 0; i < 256; ++i) {
+         auto color = colors.at<cv::Vec3b>(0, i);
+         palette[i][0] = color[2];
+         palette[i][1] = color[1];
+         palette[i][2] = color[0];
+      }
+   } else {
+      for (int i = 0; i < 256; ++i) {
+         palette[i][0] = palette[i][1] = palette[i][2] = static_cast<uint8_t>(i);
+      }
+   }
+   set_range(0.0f, 255.0f);
+}
+
+bool DepthRenderer::set_range(float const new_min_value, float new_max_value) {
+   if (new_max_value - new_min_value < 1.0f) {
+      new_max_value = new_min_value + 1.0f;
+   }
+   if (!table.empty() && new_min_value == min_value && new_max_value == max_value) {
+      return false;
+   }
+   min_value = new_min_value;
+   max_value = new_max_value;
+   auto const range = static_cast<size_t>(max_value - min_value);
+   table.resize(range + 1);
+   for (size_t i = 0; i <= range; ++i) {
+      auto const level = static_cast<uint8_t>(std::min(255.0, 255.0 * double(i) / (max_value - min_value)));
+      uint8_t entry[4] = {palette[level][0], palette[level][1], palette[level][2], 0};
+      memcpy(&table[i], entry, sizeof(entry));
+   }
+   return true;
+}
+
+template <typename T>
+size_t DepthRenderer::table_index(T const value) const {
+   // Written so that NaN ends up at the minimum.
+   float clamped = static_cast<float>(value) > min_value ? static_cast<float>(value) : min_value;
+   clamped = clamped < max_value ? clamped : max_value;
+   return static_cast<size_t>(clamped - min_value);
+}
+
+template <typename T>
+void DepthRenderer::render(
+      Matrix<T> const &pixels, uint8_t *const bitmap, size_t const bitmap_width, size_t const step) const {
+   render(pixels.view(), bitmap, bitmap_width, step);
+}
+
+template <typename T>
+void DepthRenderer::render(
+      MatrixView<T const> const pixels, uint8_t *const bitmap, size_t const bitmap_width, size_t const step) const {
+   size_t const width = (pixels.width + step - 1) / step, height = (pixels.height + step - 1) / step;
+   if (width == 0) {
+      return;
+   }
+   uint32_t const *const colors = table.data();
+   parallel_for_rows(height, [&](size_t const begin, size_t const end) {
+      for (size_t i = begin; i < end; ++i) {
+         T const *row = pixels[i * step];
+         uint8_t *destination = bitmap + 3 * i * bitmap_width;
+         // 4-byte stores overlap the next pixel, which is overwritten right after; the last pixel of a row is
+         // written byte by byte so that nothing past it is touched.
+         for (size_t j = 0; j + 1 < width; ++j) {
+            memcpy(destination + 3 * j, &colors[table_index(row[j * step])], 4);
+         }
+         memcpy(destination + 3 * (width - 1), &colors[table_index(row[(width - 1) * step])], 3);
+      }
+   });
+}
+
+void DepthRenderer::render(Picture::DepthOrIrFrame const &frame, uint8_t *const bitmap, size_t const bitmap_width,
+      size_t const step) const {
+   frame.visit_pixels([&](auto const &pixels) { render(pixels, bitmap, bitmap_width, step); });
+}
+
+#endif
@@ -17,6 +17,9 @@
    along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <execution>
+#include <numeric>
 #include <string>
 
 #include <wx/bitmap.h>
@@ -28,29 +31,34 @@
 #include <wx/wx.h>
 #include <wx/wxprec.h>
 
+#include "bitmap_panel.hpp"
+#include "depth_renderer.hpp"
 #include "picture.hpp"
 
 // Constants
 
 enum { ID_MIN_D = 101, ID_MAX_D = 102, ID_MIN_D_TEXT = 103, ID_MAX_D_TEXT = 104, ID_DISPLAY = 105 };
 
-wxDEFINE_EVENT(REFRESH_DISPLAY_EVENT, wxCommandEvent);
+size_t const preview_step = 4;
 
 // Declarations
 
 class MainWindow;
 
-class DisplayPanel : public wxPanel {
-   wxStaticBitmap *m_picture = nullptr;
-
+class DisplayPanel : public BitmapPanel {
  public:
    DisplayPanel(wxPanel *parent, wxWindowID window_id, MainWindow *window, Picture::DepthOrIrFrame *frame);
 
-   void refresh_display(wxCommandEvent &event);
-
    MainWindow *window;
    Picture::DepthOrIrFrame *frame;
    uint8_t *bitmap;
+   size_t preview_width, preview_height;
+   uint8_t *preview_bitmap;  // every preview_step-th pixel, shown while a slider is being dragged
+   bool previewing = false;
+   DepthRenderer renderer;
+
+ protected:
+   void refresh_display() override;
 };
 
 class SettingsPanel : public wxPanel {
@@ -99,6 +107,7 @@ SettingsPanel::SettingsPanel(
 }
 
 void SettingsPanel::on_min_slider_change(wxCommandEvent &event) {
+   window->m_display->previewing = event.GetEventType() == wxEVT_SCROLL_THUMBTRACK;
    if (m_max_d->GetValue() <= m_min_d->GetValue()) {
       m_max_d->SetValue(m_min_d->GetValue() + 1);
       m_max_d_text->Clear();
@@ -107,10 +116,11 @@ void SettingsPanel::on_min_slider_change(wxCommandEvent &event) {
 
    m_min_d_text->Clear();
    m_min_d_text->WriteText(std::to_string(m_min_d->GetValue()));
-   wxPostEvent(window->m_display, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+   window->m_display->request_refresh();
 }
 
 void SettingsPanel::on_max_slider_change(wxCommandEvent &event) {
+   window->m_display->previewing = event.GetEventType() == wxEVT_SCROLL_THUMBTRACK;
    if (m_max_d->GetValue() <= m_min_d->GetValue()) {
       m_min_d->SetValue(m_max_d->GetValue() - 1);
       m_min_d_text->Clear();
@@ -119,10 +129,11 @@ void SettingsPanel::on_max_slider_change(wxCommandEvent &event) {
 
    m_max_d_text->Clear();
    m_max_d_text->WriteText(std::to_string(m_max_d->GetValue()));
-   wxPostEvent(window->m_display, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+   window->m_display->request_refresh();
 }
 
 void SettingsPanel::on_min_text_change(wxCommandEvent &event) {
+   window->m_display->previewing = false;
    long min_d;
    if (!m_min_d_text->GetValue().ToLong(&min_d)) {
       return;
@@ -134,10 +145,11 @@ void SettingsPanel::on_min_text_change(wxCommandEvent &event) {
       m_max_d_text->Clear();
       m_max_d_text->WriteText(std::to_string(min_d + 1));
    }
-   wxPostEvent(window->m_display, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+   window->m_display->request_refresh();
 }
 
 void SettingsPanel::on_max_text_change(wxCommandEvent &event) {
+   window->m_display->previewing = false;
    long max_d;
    if (!m_max_d_text->GetValue().ToLong(&max_d)) {
       return;
@@ -149,65 +161,43 @@ void SettingsPanel::on_max_text_change(wxCommandEvent &event) {
       m_min_d_text->Clear();
       m_min_d_text->WriteText(std::to_string(max_d - 1));
    }
-   wxPostEvent(window->m_display, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+   window->m_display->request_refresh();
 }
 
 DisplayPanel::DisplayPanel(wxPanel *parent, wxWindowID window_id, MainWindow *window, Picture::DepthOrIrFrame *frame)
-      : wxPanel(parent, window_id, wxPoint(0, 0),
-              wxSize(static_cast<int>(frame->pixels->width), static_cast<int>(frame->pixels->height)), wxBORDER_SUNKEN),
-        frame(frame), bitmap(new uint8_t[frame->pixels->width * frame->pixels->height * 3]), window(window) {
-   Bind(REFRESH_DISPLAY_EVENT, &DisplayPanel::refresh_display, this);
-   wxPostEvent(this, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+      : BitmapPanel(parent, window_id, static_cast<int>(frame->width()), static_cast<int>(frame->height())),
+        window(window), frame(frame), bitmap(new uint8_t[frame->width() * frame->height() * 3]),
+        preview_width((frame->width() + preview_step - 1) / preview_step),
+        preview_height((frame->height() + preview_step - 1) / preview_step),
+        preview_bitmap(new uint8_t[preview_width * preview_height * 3]),
+        renderer(frame->is_depth ? Colormap::RAINBOW : Colormap::GRAYSCALE) {
+   request_refresh();
 }
 
-void DisplayPanel::refresh_display(wxCommandEvent &event) {
-   delete m_picture;
-   float min_depth = window->m_settings->m_min_d->GetValue();
-   float max_depth = window->m_settings->m_max_d->GetValue();
-   if (max_depth - min_depth < 1.0) {
-      max_depth = min_depth + 1.0f;
-   }
-   size_t width = frame->pixels->width;
-   size_t height = frame->pixels->height;
-   auto int_pixels = new uint8_t[width * height];
-   for (size_t i = 0; i < width * height; ++i) {
-      float val = 255.0f * (frame->pixels->data()[i] - min_depth) / (max_depth - min_depth);
-      val = std::min(val, 255.0f);
-      val = std::max(val, 0.0f);
-      int_pixels[i] = static_cast<uint8_t>(val);
-      if (!frame->is_depth) {
-         bitmap[3 * i] = int_pixels[i];
-         bitmap[3 * i + 1] = int_pixels[i];
-         bitmap[3 * i + 2] = int_pixels[i];
-      }
-   }
-   if (frame->is_depth) {
-      cv::Mat current_image(cv::Size(static_cast<int>(width), static_cast<int>(height)), CV_8UC1, int_pixels);
-      cv::Mat destination_image(cv::Size(static_cast<int>(width), static_cast<int>(height)), CV_8UC3);
-      cv::applyColorMap(current_image, destination_image, cv::COLORMAP_RAINBOW);
-      for (size_t i = 0; i < height; ++i) {
-         for (size_t j = 0; j < width; ++j) {
-            auto pixel = destination_image.at<cv::Vec3b>(static_cast<int>(i), static_cast<int>(j));
-            bitmap[3 * (i * width + j)] = pixel[2];
-            bitmap[3 * (i * width + j) + 1] = pixel[1];
-            bitmap[3 * (i * width + j) + 2] = pixel[0];
-         }
-      }
+void DisplayPanel::refresh_display() {
+   renderer.set_range(window->m_settings->m_min_d->GetValue(), window->m_settings->m_max_d->GetValue());
+   if (previewing) {
+      renderer.render(*frame, preview_bitmap, preview_width, preview_step);
+      show_pixels(preview_bitmap, preview_width, preview_height, preview_step);
+   } else {
+      renderer.render(*frame, bitmap, frame->width());
+      show_pixels(bitmap, frame->width(), frame->height());
    }
-   m_picture = new wxStaticBitmap(this, wxID_ANY,
-         wxBitmap(wxImage(static_cast<int>(width), static_cast<int>(height), bitmap, true)), wxDefaultPosition,
-         wxDefaultSize);
 }
 
 MainWindow::MainWindow(const wxString &title, Picture::DepthOrIrFrame *frame)
       : wxFrame(nullptr, wxID_ANY, title, wxDefaultPosition,
-              wxSize(static_cast<int>(frame->pixels->width + 150), static_cast<int>(frame->pixels->height + 200))),
+              wxSize(static_cast<int>(frame->width() + 150), static_cast<int>(frame->height() + 200))),
         m_parent(new wxPanel(this, wxID_ANY)), m_display(new DisplayPanel(m_parent, ID_DISPLAY, this, frame)) {
    int min_slider_default, max_slider_default, slider_max;
    float max_value = 0.0;
-   for (size_t i = 0; i < frame->pixels->width * frame->pixels->height; ++i) {
-      max_value = std::max(max_value, frame->pixels->data()[i]);
-   }
+   frame->visit_pixels([&](auto const &pixels) {
+      auto const all_pixels = pixels.pixels();
+      // NaN counts as 0, as it did for std::max() in a loop; without NaN max is associative, as std::reduce needs.
+      max_value = std::transform_reduce(std::execution::par_unseq, all_pixels.begin(), all_pixels.end(), 0.0f,
+            [](float const a, float const b) { return std::max(a, b); },
+            [](auto const value) { return value == value ? static_cast<float>(value) : 0.0f; });
+   });
    if (frame->is_depth) {
       min_slider_default = 500;
       slider_max = static_cast<int>(max_value);
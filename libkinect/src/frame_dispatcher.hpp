@@ -0,0 +1,111 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_DISPATCHER_HPP
+#define FRAME_DISPATCHER_HPP
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "picture.hpp"
+
+// Declarations
+
+// Fixed-size pool of worker threads which hands pictures received from a device over to a frame handler.
+// With a single worker pictures are handled in the order they were dispatched.
+class FrameDispatcher {
+ public:
+   struct Statistics {
+      uint64_t queued;   // pictures accepted into the queue
+      uint64_t dropped;  // pictures discarded because of the overflow policy or stop()
+      uint64_t handled;  // pictures for which the frame handler has returned
+      size_t backlog;    // pictures currently waiting in the queue
+   };
+
+   FrameDispatcher(size_t workers, size_t queue_capacity, OverflowPolicy overflow_policy,
+         std::function<void(Picture const &)> frame_handler);
+   FrameDispatcher(const FrameDispatcher &src) = delete;
+   ~FrameDispatcher();
+
+   void dispatch(Picture picture);
+   void stop();
+   Statistics statistics() const;
+
+ private:
+   void worker_loop();
+
+   std::function<void(Picture const &)> frame_handler;
+   BoundedQueue<Picture> queue;
+   std::vector<std::thread> workers;
+   std::atomic<uint64_t> handled_count{0};
+};
+
+// Definitions
+
+FrameDispatcher::FrameDispatcher(size_t const workers, size_t const queue_capacity,
+      OverflowPolicy const overflow_policy, std::function<void(Picture const &)> frame_handler)
+      : frame_handler(std::move(frame_handler)), queue(queue_capacity, overflow_policy) {
+   if (workers == 0) {
+      throw std::invalid_argument("FrameDispatcher needs at least one worker");
+   }
+   for (size_t i = 0; i < workers; ++i) {
+      this->workers.emplace_back(&FrameDispatcher::worker_loop, this);
+   }
+}
+
+FrameDispatcher::~FrameDispatcher() {
+   stop();
+}
+
+void FrameDispatcher::dispatch(Picture picture) {
+   queue.push(std::move(picture));
+}
+
+void FrameDispatcher::stop() {
+   queue.close();
+   for (auto &worker : workers) {
+      if (worker.joinable()) {
+         worker.join();
+      }
+   }
+}
+
+FrameDispatcher::Statistics FrameDispatcher::statistics() const {
+   return Statistics{queue.pushed(), queue.dropped(), handled_count.load(), queue.size()};
+}
+
+void FrameDispatcher::worker_loop() {
+   Picture picture;
+   while (queue.pop(picture)) {
+      try {
+         frame_handler(picture);
+      } catch (std::exception const &e) {
+         std::cerr << "frame_handler() threw an exception: " << e.what() << '\n';
+      }
+      picture = Picture();
+      ++handled_count;
+   }
+}
+
+#endif
@@ -0,0 +1,236 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Declarations
+
+// Process-wide cache of pixel buffers. Buffers are grouped in size classes (powers of two split into four steps,
+// so at most 25% of a buffer above 256 bytes is unused) and a released buffer is kept for the next request of the
+// same class instead of going back to the system allocator. The shared_ptr control blocks of the buffers are
+// recycled as well, so a steady stream of equally sized frames doesn't reach the system allocator for its pixel
+// buffers at all. Only pixel buffers are pooled: every frame still allocates its Matrix, its DepthOrIrFrame or
+// ColorFrame, the control block of the CowPtr holding it and, for Kinect v2, the shared_ptr of the libfreenect2
+// frame; a handful of small allocations next to the megabytes of pixels.
+class FramePool {
+ public:
+   struct Statistics {
+      uint64_t hits;        // requests served from cached buffers
+      uint64_t misses;      // requests which needed a new buffer
+      size_t bytes_in_use;  // handed out and not yet released
+      size_t bytes_cached;  // released and waiting for reuse
+      size_t peak_bytes;    // highest bytes_in_use + bytes_cached so far
+   };
+
+   static size_t constexpr alignment = 64;
+
+   static FramePool &instance();
+
+   // The buffer goes back to the pool when the last copy of the returned pointer is destroyed.
+   std::shared_ptr<void> allocate(size_t bytes);
+   Statistics statistics() const;
+   // Cached buffers above this limit are returned to the system allocator.
+   void set_max_cached_bytes(size_t bytes);
+   // Returns the cached buffers and control blocks to the system allocator.
+   void release_cached();
+
+ private:
+   FramePool() = default;
+
+   // Allocator for the control blocks of the pointers returned by allocate().
+   template <typename T>
+   struct ControlBlockAllocator {
+      using value_type = T;
+
+      ControlBlockAllocator() = default;
+      template <typename U>
+      ControlBlockAllocator(ControlBlockAllocator<U> const &other);
+
+      T *allocate(size_t n);
+      void deallocate(T *block, size_t n);
+      template <typename U>
+      bool operator==(ControlBlockAllocator<U> const &other) const;
+      template <typename U>
+      bool operator!=(ControlBlockAllocator<U> const &other) const;
+   };
+
+   static size_t size_class(size_t bytes);
+   void give_back(void *buffer, size_t buffer_size);
+   void *take_control_block(size_t bytes);
+   void give_back_control_block(void *block, size_t bytes);
+
+   mutable std::mutex mutex;
+   std::map<size_t, std::vector<void *>> cached_buffers;
+   std::map<size_t, std::vector<void *>> cached_control_blocks;
+   size_t max_cached_bytes = size_t(512) << 20;
+   Statistics stats{0, 0, 0, 0, 0};
+};
+
+// Definitions
+
+FramePool &FramePool::instance() {
+   // Never destroyed, so that buffers released during static destruction still have somewhere to go.
+   static FramePool *pool = new FramePool();
+   return *pool;
+}
+
+size_t FramePool::size_class(size_t const bytes) {
+   if (bytes <= alignment) {
+      return alignment;
+   }
+   size_t power = alignment;
+   while (power * 2 < bytes) {
+      power *= 2;
+   }
+   // bytes is in (power, 2 * power], pick the smallest of the four steps that fits. Steps of small classes are
+   // rounded up to the alignment, which aligned_alloc() requires the size to be a multiple of.
+   size_t const step = std::max(power / 4, alignment);
+   return power + (bytes - power + step - 1) / step * step;
+}
+
+std::shared_ptr<void> FramePool::allocate(size_t const bytes) {
+   size_t const buffer_size = size_class(bytes);
+   void *buffer = nullptr;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &free_buffers = cached_buffers[buffer_size];
+      if (!free_buffers.empty()) {
+         buffer = free_buffers.back();
+         free_buffers.pop_back();
+         stats.bytes_cached -= buffer_size;
+         ++stats.hits;
+      } else {
+         ++stats.misses;
+      }
+      stats.bytes_in_use += buffer_size;
+   }
+   if (buffer == nullptr) {
+      buffer = std::aligned_alloc(alignment, buffer_size);
+      if (buffer == nullptr) {
+         std::lock_guard<std::mutex> lock(mutex);
+         stats.bytes_in_use -= buffer_size;
+         throw std::bad_alloc();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.peak_bytes = std::max(stats.peak_bytes, stats.bytes_in_use + stats.bytes_cached);
+   }
+   return std::shared_ptr<void>(buffer, [this, buffer_size](void *released) { give_back(released, buffer_size); },
+         ControlBlockAllocator<void>());
+}
+
+void FramePool::give_back(void *const buffer, size_t const buffer_size) {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.bytes_in_use -= buffer_size;
+      if (stats.bytes_cached + buffer_size <= max_cached_bytes) {
+         cached_buffers[buffer_size].push_back(buffer);
+         stats.bytes_cached += buffer_size;
+         return;
+      }
+   }
+   std::free(buffer);
+}
+
+template <typename T>
+template <typename U>
+FramePool::ControlBlockAllocator<T>::ControlBlockAllocator(ControlBlockAllocator<U> const &) {}
+
+template <typename T>
+T *FramePool::ControlBlockAllocator<T>::allocate(size_t const n) {
+   return static_cast<T *>(FramePool::instance().take_control_block(n * sizeof(T)));
+}
+
+template <typename T>
+void FramePool::ControlBlockAllocator<T>::deallocate(T *const block, size_t const n) {
+   FramePool::instance().give_back_control_block(block, n * sizeof(T));
+}
+
+// All control blocks come from the one pool, so any allocator can free what another allocated.
+template <typename T>
+template <typename U>
+bool FramePool::ControlBlockAllocator<T>::operator==(ControlBlockAllocator<U> const &) const {
+   return true;
+}
+
+template <typename T>
+template <typename U>
+bool FramePool::ControlBlockAllocator<T>::operator!=(ControlBlockAllocator<U> const &) const {
+   return false;
+}
+
+void *FramePool::take_control_block(size_t const bytes) {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &free_blocks = cached_control_blocks[bytes];
+      if (!free_blocks.empty()) {
+         void *block = free_blocks.back();
+         free_blocks.pop_back();
+         return block;
+      }
+   }
+   return ::operator new(bytes);
+}
+
+void FramePool::give_back_control_block(void *const block, size_t const bytes) {
+   std::lock_guard<std::mutex> lock(mutex);
+   cached_control_blocks[bytes].push_back(block);
+}
+
+FramePool::Statistics FramePool::statistics() const {
+   std::lock_guard<std::mutex> lock(mutex);
+   return stats;
+}
+
+void FramePool::set_max_cached_bytes(size_t const bytes) {
+   std::lock_guard<std::mutex> lock(mutex);
+   max_cached_bytes = bytes;
+}
+
+void FramePool::release_cached() {
+   std::map<size_t, std::vector<void *>> released, released_control_blocks;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      released.swap(cached_buffers);
+      released_control_blocks.swap(cached_control_blocks);
+      stats.bytes_cached = 0;
+   }
+   for (auto &size_and_buffers : released) {
+      for (void *buffer : size_and_buffers.second) {
+         std::free(buffer);
+      }
+   }
+   for (auto &size_and_blocks : released_control_blocks) {
+      for (void *block : size_and_blocks.second) {
+         ::operator delete(block);
+      }
+   }
+}
+
+#endif
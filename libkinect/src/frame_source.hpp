@@ -0,0 +1,43 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_SOURCE_HPP
+#define FRAME_SOURCE_HPP
+
+#include <functional>
+
+#include "picture.hpp"
+
+// Declarations
+
+// Something other than a real Kinect which a KinectDevice can get its frames from, e.g. a recorded session.
+// Sources deliver one frame per picture, like the Kinect callbacks do.
+class FrameSource {
+ public:
+   virtual ~FrameSource() = default;
+
+   // Starts delivering frames of the selected streams from a thread of the source.
+   virtual void start(bool color, bool depth, bool ir, std::function<void(Picture)> deliver) = 0;
+   // Returns once deliver won't be called anymore.
+   virtual void stop() = 0;
+   // The Kinect version (1 or 2) whose frames this source delivers.
+   virtual int which_kinect() const = 0;
+};
+
+#endif
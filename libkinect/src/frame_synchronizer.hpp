@@ -0,0 +1,285 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_SYNCHRONIZER_HPP
+#define FRAME_SYNCHRONIZER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "picture.hpp"
+
+// Declarations
+
+// Which frame field FrameSynchronizer matches streams by.
+enum class SyncKey {
+   TIMESTAMP,  // device timestamps, equal up to a tolerance
+   SEQUENCE    // sequence numbers, which must be equal; only Kinect v2 depth and IR frames share them
+};
+
+// Collects frames of the selected streams in a small ring per stream and puts together complete pictures whose
+// frames were taken at the same moment according to the device. Safe to use from several threads.
+class FrameSynchronizer {
+ public:
+   struct Statistics {
+      uint64_t received;   // frames of the synchronized streams pushed so far
+      uint64_t matched;    // complete pictures put together
+      uint64_t discarded;  // frames which left the rings without being matched
+      double match_rate;   // share of the received frames which ended up in a complete picture
+   };
+
+   // tolerance is in device timestamp units; 0 means half of the sensor's frame period, measured from the frames seen
+   // so far as timestamp difference per sequence step, which works without knowing the device's clock rate and still
+   // holds when only some of the sensor's frames are delivered.
+   FrameSynchronizer(bool color, bool depth, bool ir, SyncKey sync_key, uint32_t tolerance = 0, size_t ring_size = 4);
+
+   // Takes the synchronized frames out of picture, other frames are ignored. Returns true and sets matched when
+   // they complete a picture.
+   bool push(Picture const &picture, Picture &matched);
+   Statistics statistics() const;
+   void reset();
+
+   SyncKey const sync_key;
+
+ private:
+   static size_t constexpr stream_count = 3;  // color, depth, IR
+
+   struct Entry {
+      uint32_t key;
+      Picture frame;  // only the frame of the ring's stream is set
+   };
+
+   struct Ring {
+      std::vector<Entry> entries;  // oldest first
+      uint32_t last_key = 0, last_sequence = 0;
+      uint32_t frame_period = 0;  // 0 until two frames have been seen
+      bool has_last_key = false;
+   };
+
+   static bool has_frame(Picture const &picture, size_t stream);
+   static void copy_frame(Picture const &source, Picture &destination, size_t stream);
+   static uint32_t frame_sequence(Picture const &picture, size_t stream);
+   uint32_t frame_key(Picture const &picture, size_t stream) const;
+   uint32_t current_tolerance() const;
+   void insert(size_t stream, uint32_t key, uint32_t sequence, Picture const &picture);
+   bool try_match(size_t stream, uint32_t key, Picture &matched);
+
+   bool synchronized[stream_count];
+   size_t synchronized_count = 0;
+   uint32_t const tolerance;
+   size_t const ring_size;
+
+   mutable std::mutex mutex;
+   Ring rings[stream_count];
+   uint64_t received_count = 0, matched_count = 0, matched_frames = 0, discarded_count = 0;
+};
+
+// Definitions
+
+FrameSynchronizer::FrameSynchronizer(bool const color, bool const depth, bool const ir, SyncKey const sync_key,
+      uint32_t const tolerance, size_t const ring_size)
+      : sync_key(sync_key), synchronized{color, depth, ir}, tolerance(tolerance), ring_size(ring_size) {
+   for (size_t stream = 0; stream < stream_count; ++stream) {
+      if (synchronized[stream]) {
+         ++synchronized_count;
+      }
+      rings[stream].entries.reserve(ring_size);
+   }
+   if (synchronized_count < 2) {
+      throw std::invalid_argument("FrameSynchronizer needs at least two streams");
+   }
+   if (ring_size == 0) {
+      throw std::invalid_argument("FrameSynchronizer ring size must be positive");
+   }
+}
+
+bool FrameSynchronizer::push(Picture const &picture, Picture &matched) {
+   std::lock_guard<std::mutex> lock(mutex);
+   bool any_matched = false;
+   for (size_t stream = 0; stream < stream_count; ++stream) {
+      if (!synchronized[stream] || !has_frame(picture, stream)) {
+         continue;
+      }
+      uint32_t const key = frame_key(picture, stream);
+      insert(stream, key, frame_sequence(picture, stream), picture);
+      if (try_match(stream, key, matched)) {
+         any_matched = true;
+      }
+   }
+   return any_matched;
+}
+
+FrameSynchronizer::Statistics FrameSynchronizer::statistics() const {
+   std::lock_guard<std::mutex> lock(mutex);
+   double match_rate = received_count == 0 ? 0.0 : double(matched_frames) / double(received_count);
+   return Statistics{received_count, matched_count, discarded_count, match_rate};
+}
+
+void FrameSynchronizer::reset() {
+   std::lock_guard<std::mutex> lock(mutex);
+   for (auto &ring : rings) {
+      ring.entries.clear();
+      ring.has_last_key = false;
+      ring.frame_period = 0;
+   }
+   received_count = matched_count = matched_frames = discarded_count = 0;
+}
+
+bool FrameSynchronizer::has_frame(Picture const &picture, size_t const stream) {
+   switch (stream) {
+      case 0:
+         return bool(picture.color_frame);
+      case 1:
+         return bool(picture.depth_frame);
+      default:
+         return bool(picture.ir_frame);
+   }
+}
+
+void FrameSynchronizer::copy_frame(Picture const &source, Picture &destination, size_t const stream) {
+   switch (stream) {
+      case 0:
+         destination.color_frame = source.color_frame;
+         break;
+      case 1:
+         destination.depth_frame = source.depth_frame;
+         break;
+      default:
+         destination.ir_frame = source.ir_frame;
+   }
+}
+
+uint32_t FrameSynchronizer::frame_sequence(Picture const &picture, size_t const stream) {
+   switch (stream) {
+      case 0:
+         return picture.color_frame->sequence;
+      case 1:
+         return picture.depth_frame->sequence;
+      default:
+         return picture.ir_frame->sequence;
+   }
+}
+
+uint32_t FrameSynchronizer::frame_key(Picture const &picture, size_t const stream) const {
+   bool const by_sequence = sync_key == SyncKey::SEQUENCE;
+   switch (stream) {
+      case 0:
+         return by_sequence ? picture.color_frame->sequence : picture.color_frame->timestamp;
+      case 1:
+         return by_sequence ? picture.depth_frame->sequence : picture.depth_frame->timestamp;
+      default:
+         return by_sequence ? picture.ir_frame->sequence : picture.ir_frame->timestamp;
+   }
+}
+
+uint32_t FrameSynchronizer::current_tolerance() const {
+   if (sync_key == SyncKey::SEQUENCE) {
+      return 0;
+   } else if (tolerance != 0) {
+      return tolerance;
+   }
+   uint32_t frame_period = 0;
+   for (size_t stream = 0; stream < stream_count; ++stream) {
+      uint32_t const period = rings[stream].frame_period;
+      if (synchronized[stream] && period != 0 && (frame_period == 0 || period < frame_period)) {
+         frame_period = period;
+      }
+   }
+   return frame_period / 2;
+}
+
+void FrameSynchronizer::insert(size_t const stream, uint32_t const key, uint32_t const sequence,
+      Picture const &picture) {
+   Ring &ring = rings[stream];
+   if (ring.has_last_key) {
+      // Keys and sequences are compared as signed differences, so that they can wrap around. Sequences count the
+      // sensor's frames, also those dropped before reaching here, so the interval per step is the sensor's period.
+      // Frames without sequence numbers count as consecutive.
+      auto const interval = static_cast<int32_t>(key - ring.last_key);
+      auto const steps = static_cast<int32_t>(sequence - ring.last_sequence);
+      if (interval > 0 && steps >= 0) {
+         uint32_t const period = uint32_t(interval) / uint32_t(std::max(steps, 1));
+         if (period != 0 && (ring.frame_period == 0 || period < ring.frame_period)) {
+            ring.frame_period = period;
+         }
+      }
+   }
+   ring.last_key = key;
+   ring.last_sequence = sequence;
+   ring.has_last_key = true;
+
+   if (ring.entries.size() == ring_size) {
+      ring.entries.erase(ring.entries.begin());
+      ++discarded_count;
+   }
+   Entry entry{key, Picture()};
+   copy_frame(picture, entry.frame, stream);
+   ring.entries.push_back(std::move(entry));
+   ++received_count;
+}
+
+bool FrameSynchronizer::try_match(size_t const stream, uint32_t const key, Picture &matched) {
+   uint32_t const max_distance = current_tolerance();
+   size_t matched_index[stream_count];
+   for (size_t other = 0; other < stream_count; ++other) {
+      if (!synchronized[other]) {
+         continue;
+      }
+      if (other == stream) {
+         matched_index[other] = rings[other].entries.size() - 1;
+         continue;
+      }
+      auto const &entries = rings[other].entries;
+      bool found = false;
+      uint32_t best_distance = 0;
+      for (size_t i = 0; i < entries.size(); ++i) {
+         auto const difference = static_cast<int32_t>(entries[i].key - key);
+         auto const distance = difference < 0 ? uint32_t(-int64_t(difference)) : uint32_t(difference);
+         if (distance <= max_distance && (!found || distance < best_distance)) {
+            found = true;
+            best_distance = distance;
+            matched_index[other] = i;
+         }
+      }
+      if (!found) {
+         return false;
+      }
+   }
+
+   matched = Picture();
+   for (size_t other = 0; other < stream_count; ++other) {
+      if (!synchronized[other]) {
+         continue;
+      }
+      auto &entries = rings[other].entries;
+      copy_frame(entries[matched_index[other]].frame, matched, other);
+      // Frames older than the matched one can't be part of a later picture.
+      discarded_count += matched_index[other];
+      entries.erase(entries.begin(), entries.begin() + long(matched_index[other]) + 1);
+   }
+   ++matched_count;
+   matched_frames += synchronized_count;
+   return true;
+}
+
+#endif
@@ -0,0 +1,216 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_WRITER_HPP
+#define FRAME_WRITER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "picture.hpp"
+
+// Declarations
+
+// Saves pictures to files on a fixed number of worker threads, which do the PNG encoding and gzip compression.
+// Queued pictures share their frames with the caller (see CowPtr), so nothing is copied before writing.
+class FrameWriter {
+ public:
+   struct StreamStatistics {
+      uint64_t written;           // files written successfully
+      uint64_t failed;            // files which could not be written
+      double average_latency_ms;  // from save() until the file was closed
+      double max_latency_ms;
+   };
+
+   struct Statistics {
+      uint64_t queued;   // pictures accepted into the queue
+      uint64_t dropped;  // pictures discarded because of the overflow policy or stop()
+      size_t backlog;    // pictures waiting in the queue or being written
+      StreamStatistics color, depth, ir;
+   };
+
+   // With OverflowPolicy::BLOCK no picture is lost, save() waits for room in the queue instead.
+   FrameWriter(size_t workers = 2, size_t queue_capacity = 32, OverflowPolicy overflow_policy = OverflowPolicy::BLOCK,
+         DepthCompression depth_compression = DepthCompression::GZIP);
+   FrameWriter(const FrameWriter &src) = delete;
+   // Writes everything still queued before returning.
+   ~FrameWriter();
+
+   // Writes the frames present in the picture as base_filename + ".png", ".depth" and ".ir" (see save_all_to_files),
+   // depth and IR compressed with depth_compression.
+   void save(Picture picture, std::string base_filename);
+   // Blocks until every picture saved so far has been written.
+   void flush();
+   // Stops the workers, pictures still queued are discarded. Call flush() first to keep them.
+   void stop();
+   Statistics statistics() const;
+
+ private:
+   struct Job {
+      Picture picture;
+      std::string base_filename;
+      std::chrono::steady_clock::time_point queued_at;
+   };
+
+   struct StreamCounters {
+      uint64_t written = 0, failed = 0;
+      double total_latency_ms = 0.0, max_latency_ms = 0.0;
+
+      void record(bool success, double latency_ms);
+      StreamStatistics statistics() const;
+   };
+
+   void worker_loop();
+   void write_job(Job const &job);
+   void save_frame(Picture::ColorFrame const &frame, std::string const &filename) const;
+   void save_frame(Picture::DepthOrIrFrame const &frame, std::string const &filename) const;
+
+   DepthCompression const depth_compression;
+   BoundedQueue<Job> queue;
+   std::vector<std::thread> workers;
+
+   mutable std::mutex mutex;
+   std::condition_variable all_written;
+   size_t unfinished = 0;  // saved but not written yet
+   StreamCounters color_counters, depth_counters, ir_counters;
+};
+
+// Definitions
+
+FrameWriter::FrameWriter(size_t const workers, size_t const queue_capacity, OverflowPolicy const overflow_policy,
+      DepthCompression const depth_compression)
+      : depth_compression(depth_compression), queue(queue_capacity, overflow_policy) {
+   if (workers == 0) {
+      throw std::invalid_argument("FrameWriter needs at least one worker");
+   }
+   for (size_t i = 0; i < workers; ++i) {
+      this->workers.emplace_back(&FrameWriter::worker_loop, this);
+   }
+}
+
+FrameWriter::~FrameWriter() {
+   flush();
+   stop();
+}
+
+void FrameWriter::save(Picture picture, std::string base_filename) {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++unfinished;
+   }
+   // With a DROP_* policy a push may discard this job or an older one; either way exactly one job won't be written.
+   if (!queue.push(Job{std::move(picture), std::move(base_filename), std::chrono::steady_clock::now()})) {
+      std::lock_guard<std::mutex> lock(mutex);
+      --unfinished;
+      if (unfinished == 0) {
+         all_written.notify_all();
+      }
+   }
+}
+
+void FrameWriter::flush() {
+   std::unique_lock<std::mutex> lock(mutex);
+   all_written.wait(lock, [this] { return unfinished == 0; });
+}
+
+void FrameWriter::stop() {
+   queue.close();
+   for (auto &worker : workers) {
+      if (worker.joinable()) {
+         worker.join();
+      }
+   }
+   std::lock_guard<std::mutex> lock(mutex);
+   unfinished = 0;
+   all_written.notify_all();
+}
+
+FrameWriter::Statistics FrameWriter::statistics() const {
+   std::lock_guard<std::mutex> lock(mutex);
+   return Statistics{queue.pushed(), queue.dropped(), unfinished, color_counters.statistics(),
+         depth_counters.statistics(), ir_counters.statistics()};
+}
+
+void FrameWriter::StreamCounters::record(bool const success, double const latency_ms) {
+   if (!success) {
+      ++failed;
+      return;
+   }
+   ++written;
+   total_latency_ms += latency_ms;
+   max_latency_ms = std::max(max_latency_ms, latency_ms);
+}
+
+FrameWriter::StreamStatistics FrameWriter::StreamCounters::statistics() const {
+   return StreamStatistics{written, failed, written == 0 ? 0.0 : total_latency_ms / double(written), max_latency_ms};
+}
+
+void FrameWriter::worker_loop() {
+   Job job;
+   while (queue.pop(job)) {
+      write_job(job);
+      job = Job();
+      std::lock_guard<std::mutex> lock(mutex);
+      --unfinished;
+      if (unfinished == 0) {
+         all_written.notify_all();
+      }
+   }
+}
+
+void FrameWriter::write_job(Job const &job) {
+   auto write = [&](auto const &frame, std::string const &extension, StreamCounters &counters) {
+      if (!frame) {
+         return;
+      }
+      bool success = true;
+      try {
+         save_frame(*frame, job.base_filename + extension);
+      } catch (std::exception const &e) {
+         std::cerr << "FrameWriter could not save " << job.base_filename + extension << ": " << e.what() << '\n';
+         success = false;
+      }
+      double latency_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job.queued_at).count();
+      std::lock_guard<std::mutex> lock(mutex);
+      counters.record(success, latency_ms);
+   };
+   write(job.picture.color_frame, ".png", color_counters);
+   write(job.picture.depth_frame, ".depth", depth_counters);
+   write(job.picture.ir_frame, ".ir", ir_counters);
+}
+
+void FrameWriter::save_frame(Picture::ColorFrame const &frame, std::string const &filename) const {
+   frame.save_to_file(filename);
+}
+
+void FrameWriter::save_frame(Picture::DepthOrIrFrame const &frame, std::string const &filename) const {
+   frame.save_to_file(filename, depth_compression);
+}
+
+#endif
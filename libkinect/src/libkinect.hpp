@@ -20,23 +20,35 @@
 #ifndef LIBKINECT_HPP
 #define LIBKINECT_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <iostream>
+#include <memory>
 #include <thread>
 
 #include <libfreenect/libfreenect.h>
 #include <libfreenect2/libfreenect2.hpp>
 
+#include "frame_dispatcher.hpp"
+#include "frame_source.hpp"
 #include "picture.hpp"
+#include "pixel_conversion.hpp"
 
 // Declarations
 
 class KinectDevice {
  public:
+   enum class Stream { COLOR, DEPTH, IR };
+
    explicit KinectDevice(int device_number);
+   // Uses the source instead of a real device.
+   explicit KinectDevice(std::unique_ptr<FrameSource> frame_source);
    ~KinectDevice();
 
    void start_streams(bool color, bool depth, bool ir);
@@ -44,11 +56,56 @@ class KinectDevice {
    void close();
    virtual void frame_handler(Picture const &picture) const = 0;
 
+   // Takes effect on the next start_streams(). frame_handler() must be thread-safe when using more than one worker.
+   void set_frame_dispatch(size_t workers, size_t queue_capacity, OverflowPolicy overflow_policy);
+   FrameDispatcher::Statistics frame_dispatch_statistics() const;
+
+   // Delivers only every decimation-th frame of the stream, and no more than max_fps of them per second (0 means no
+   // limit). Other frames are dropped in the device callback, before they are copied or converted. When depth and IR
+   // have the same limits, their frames of one moment are kept or dropped together, so that they can still be paired:
+   // the first of them to arrive decides for both. Can be changed while streaming.
+   void set_stream_limit(Stream stream, uint32_t decimation, double max_fps = 0.0);
+   // Frames dropped because of the stream's limit.
+   uint64_t limited_frames(Stream stream) const;
+
    int which_kinect = 0;  // 1 or 2 set in constructor
 
  protected:
+   void dispatch_picture(Picture picture);
+   // Decides whether a frame of the stream gets through the stream's limit. time is measured from any fixed point.
+   bool admit_frame(Stream stream, uint32_t sequence, std::chrono::nanoseconds time);
+
+   size_t dispatch_workers = 1, dispatch_queue_capacity = 4;
+   OverflowPolicy dispatch_overflow_policy = OverflowPolicy::DROP_OLDEST;
+   std::unique_ptr<FrameDispatcher> frame_dispatcher;
+   FrameDispatcher::Statistics last_dispatch_statistics{0, 0, 0, 0};
+
+   struct StreamLimit {
+      std::atomic<uint32_t> decimation{1};
+      std::atomic<int64_t> min_interval_ns{0};
+      std::atomic<uint64_t> limited{0};
+      int64_t next_due_ns = 0;  // only used by the device's callback thread
+   };
+   StreamLimit stream_limits[3];
+   // The limit's own decision, which admit_frame() may share between depth and IR.
+   static bool within_limit(StreamLimit &limit, uint32_t sequence, int64_t now);
+
+   // The last decision made for depth and IR together, followed by the other of the two streams for its frame of the
+   // same moment: the same sequence number on Kinect v2, the nearest time on Kinect v1, whose streams count frames
+   // separately. Depth and IR callbacks run on one thread per device, which is the only one using it.
+   struct SharedDecision {
+      Stream decided_by;
+      uint32_t sequence;
+      int64_t time_ns;
+      bool admitted;
+      bool followed;
+   };
+   SharedDecision depth_and_ir_decision{Stream::DEPTH, 0, 0, false, true};
+
    bool color_running = false, depth_running = false, ir_running = false;
+   std::unique_ptr<FrameSource> frame_source;  // set instead of a Kinect v1 or v2 device
    // Kinect v1:
+   uint32_t kinect1_depth_sequence = 0, kinect1_video_sequence = 0;
    freenect_context *freenect1_context = nullptr;
    freenect_device *freenect1_device = nullptr;
    void *video_buffer_freenect1 = nullptr, *video_buffer_mine = nullptr;
@@ -56,6 +113,8 @@ class KinectDevice {
    libfreenect2::Freenect2 freenect2;
    libfreenect2::Freenect2Device *freenect2_device = nullptr;
    libfreenect2::PacketPipeline *freenect2_pipeline = nullptr;
+   // Read from the device once it streams, then given to its depth and IR frames. Use std::atomic_load/store.
+   std::shared_ptr<CameraParameters const> camera_parameters;
 
  private:
    std::atomic_flag kinect1_run_event_loop = ATOMIC_FLAG_INIT;
@@ -87,6 +146,8 @@ class KinectDevice {
    Kinect2DepthAndIrListener *kinect2_depth_and_ir_listener = nullptr;
 };
 
+std::chrono::nanoseconds kinect2_timestamp_to_duration(uint32_t timestamp);
+
 // Definitions
 
 KinectDevice::KinectDevice(int device_number = 0) {
@@ -121,18 +182,49 @@ KinectDevice::KinectDevice(int device_number = 0) {
    }
 }
 
+KinectDevice::KinectDevice(std::unique_ptr<FrameSource> frame_source) : frame_source(std::move(frame_source)) {
+   if (!this->frame_source) {
+      throw std::invalid_argument("KinectDevice needs a frame source");
+   }
+   which_kinect = this->frame_source->which_kinect();
+}
+
 KinectDevice::~KinectDevice() {
    stop_streams();
    close();
 }
 
 void KinectDevice::start_streams(bool color, bool depth, bool ir) {
-   if (which_kinect == 1) {
+   if (frame_source) {
+      stop_streams();
+      frame_dispatcher.reset(new FrameDispatcher(dispatch_workers, dispatch_queue_capacity, dispatch_overflow_policy,
+            [this](Picture const &picture) { frame_handler(picture); }));
+      frame_source->start(color, depth, ir, [this](Picture picture) {
+         // Frames from sources are already converted, but limiting them still saves the frame handler's work.
+         auto admit = [&](auto const &frame, Stream stream) {
+            auto time = which_kinect == 2 && frame->timestamp != 0
+                  ? kinect2_timestamp_to_duration(frame->timestamp)
+                  : std::chrono::duration_cast<std::chrono::nanoseconds>(frame->time_received.time_since_epoch());
+            return admit_frame(stream, frame->sequence, time);
+         };
+         if ((picture.color_frame && !admit(picture.color_frame, Stream::COLOR))
+               || (picture.depth_frame && !admit(picture.depth_frame, Stream::DEPTH))
+               || (picture.ir_frame && !admit(picture.ir_frame, Stream::IR))) {
+            return;
+         }
+         dispatch_picture(std::move(picture));
+      });
+      color_running = color;
+      depth_running = depth;
+      ir_running = ir;
+   } else if (which_kinect == 1) {
       if (color && ir) {
          throw std::invalid_argument("Kinect v1: can't stream RGB and IR at the same time");
       }
 
       stop_streams();
+      frame_dispatcher.reset(new FrameDispatcher(dispatch_workers, dispatch_queue_capacity, dispatch_overflow_policy,
+            [this](Picture const &picture) { frame_handler(picture); }));
 
       if (depth) {
          if (freenect_set_depth_mode(
@@ -178,6 +270,8 @@ void KinectDevice::start_streams(bool color, bool depth, bool ir) {
       }
 
       stop_streams();
+      frame_dispatcher.reset(new FrameDispatcher(dispatch_workers, dispatch_queue_capacity, dispatch_overflow_policy,
+            [this](Picture const &picture) { frame_handler(picture); }));
 
       if (color) {
          kinect2_color_listener = new Kinect2ColorListener(this);
@@ -191,6 +285,10 @@ void KinectDevice::start_streams(bool color, bool depth, bool ir) {
       if (!freenect2_device->startStreams(color, depth && ir)) {
          throw std::runtime_error("freenect2_device->startStreams() failed");
       }
+      // libfreenect2 only knows the parameters after starting, so the first frames may come without them.
+      std::atomic_store(&camera_parameters,
+            std::shared_ptr<CameraParameters const>(new CameraParameters{
+                  freenect2_device->getIrCameraParams(), freenect2_device->getColorCameraParams()}));
       depth_running = depth;
       color_running = color;
       ir_running = ir;
@@ -198,7 +296,9 @@ void KinectDevice::start_streams(bool color, bool depth, bool ir) {
 }
 
 void KinectDevice::stop_streams() {
-   if (which_kinect == 1) {
+   if (frame_source) {
+      frame_source->stop();
+   } else if (which_kinect == 1) {
       kinect1_run_event_loop.clear();
       if (kinect1_event_thread != nullptr) {
          kinect1_event_thread->join();
@@ -225,6 +325,11 @@ void KinectDevice::stop_streams() {
       kinect2_depth_and_ir_listener = nullptr;
       kinect2_color_listener = nullptr;
    }
+   if (frame_dispatcher) {
+      frame_dispatcher->stop();
+      last_dispatch_statistics = frame_dispatcher->statistics();
+      frame_dispatcher.reset();
+   }
    depth_running = false;
    color_running = false;
    ir_running = false;
@@ -234,6 +339,91 @@ void KinectDevice::close() {
    stop_streams();
 }
 
+void KinectDevice::set_frame_dispatch(
+      size_t const workers, size_t const queue_capacity, OverflowPolicy const overflow_policy) {
+   if (workers == 0 || queue_capacity == 0) {
+      throw std::invalid_argument("Frame dispatch needs at least one worker and a positive queue capacity");
+   }
+   dispatch_workers = workers;
+   dispatch_queue_capacity = queue_capacity;
+   dispatch_overflow_policy = overflow_policy;
+}
+
+FrameDispatcher::Statistics KinectDevice::frame_dispatch_statistics() const {
+   if (frame_dispatcher) {
+      return frame_dispatcher->statistics();
+   }
+   return last_dispatch_statistics;
+}
+
+void KinectDevice::dispatch_picture(Picture picture) {
+   if (frame_dispatcher) {
+      frame_dispatcher->dispatch(std::move(picture));
+   }
+}
+
+void KinectDevice::set_stream_limit(Stream const stream, uint32_t const decimation, double const max_fps) {
+   if (decimation == 0 || max_fps < 0.0) {
+      throw std::invalid_argument("Stream limits need a positive decimation and a non-negative frame rate");
+   }
+   auto &limit = stream_limits[static_cast<size_t>(stream)];
+   limit.decimation = decimation;
+   limit.min_interval_ns = max_fps > 0.0 ? static_cast<int64_t>(1e9 / max_fps) : 0;
+}
+
+uint64_t KinectDevice::limited_frames(Stream const stream) const {
+   return stream_limits[static_cast<size_t>(stream)].limited;
+}
+
+bool KinectDevice::admit_frame(Stream const stream, uint32_t const sequence, std::chrono::nanoseconds const time) {
+   auto &limit = stream_limits[static_cast<size_t>(stream)];
+   auto &depth_limit = stream_limits[static_cast<size_t>(Stream::DEPTH)];
+   auto &ir_limit = stream_limits[static_cast<size_t>(Stream::IR)];
+   bool const shared = (stream == Stream::DEPTH || stream == Stream::IR)
+         && depth_limit.decimation == ir_limit.decimation && depth_limit.min_interval_ns == ir_limit.min_interval_ns;
+   bool admitted;
+   if (!shared) {
+      admitted = within_limit(limit, sequence, time.count());
+   } else {
+      auto &decision = depth_and_ir_decision;
+      // Kinect v1 streams both run at 30 fps, so frames of one moment are less than half a frame apart.
+      bool const same_moment = which_kinect == 2 ? sequence == decision.sequence
+                                                  : std::abs(time.count() - decision.time_ns) < 16666667;
+      if (!decision.followed && decision.decided_by != stream && same_moment) {
+         decision.followed = true;
+         admitted = decision.admitted;
+      } else {
+         // Both streams count from depth's due time, whichever of them decides.
+         admitted = within_limit(depth_limit, sequence, time.count());
+         decision = SharedDecision{stream, sequence, time.count(), admitted, false};
+      }
+   }
+   if (!admitted) {
+      ++limit.limited;
+   }
+   return admitted;
+}
+
+bool KinectDevice::within_limit(StreamLimit &limit, uint32_t const sequence, int64_t const now) {
+   if (sequence % limit.decimation != 0) {
+      return false;
+   }
+   int64_t const interval = limit.min_interval_ns;
+   if (interval == 0) {
+      return true;
+   }
+   if (now < limit.next_due_ns && limit.next_due_ns - now <= 10 * interval) {
+      return false;
+   }
+   // Counting from when the frame was due rather than when it came keeps the average rate at max_fps despite
+   // jitter. After a pause (or a clock going back) counting starts over.
+   limit.next_due_ns += interval;
+   if (limit.next_due_ns <= now || limit.next_due_ns - now > interval) {
+      limit.next_due_ns = now + interval;
+   }
+   return true;
+}
+
 void KinectDevice::kinect1_process_events() {
    while (freenect_process_events(freenect1_context) == 0) {
       if (!kinect1_run_event_loop.test_and_set()) {
@@ -244,23 +434,33 @@ void KinectDevice::kinect1_process_events() {
 
 void KinectDevice::kinect1_depth_callback(freenect_device *device, void *depth_void, uint32_t timestamp) {
    auto kinect_device = static_cast<KinectDevice *>(freenect_get_user(device));
+   uint32_t const sequence = kinect_device->kinect1_depth_sequence++;
+   if (!kinect_device->admit_frame(Stream::DEPTH, sequence, std::chrono::steady_clock::now().time_since_epoch())) {
+      return;
+   }
    auto frame_mode = freenect_get_current_depth_mode(device);
    auto width = static_cast<size_t>(frame_mode.width);
    auto height = static_cast<size_t>(frame_mode.height);
-   auto pixels = new Matrix<float>(height, width);
-   for (size_t i = 0; i < frame_mode.height; ++i) {
-      for (size_t j = 0; j < frame_mode.width; ++j) {
-         (*pixels)[i][j] = float(static_cast<uint16_t *>(depth_void)[frame_mode.width * i + j]);
-      }
-   }
+   auto pixels = new Matrix<uint16_t>(height, width);
+   memcpy(pixels->data(), depth_void, height * width * sizeof(uint16_t));
+   auto depth_frame = new Picture::DepthOrIrFrame(pixels, true);
+   depth_frame->timestamp = timestamp;
+   depth_frame->sequence = sequence;
+   depth_frame->which_kinect = 1;
    Picture picture;
-   picture.depth_frame = new Picture::DepthOrIrFrame(pixels, true);
-   auto frame_handler_thread = std::thread(&KinectDevice::frame_handler, kinect_device, picture);
-   frame_handler_thread.detach();
+   picture.depth_frame.reset(depth_frame);
+   kinect_device->dispatch_picture(std::move(picture));
 }
 
 void KinectDevice::kinect1_video_callback(freenect_device *device, void *buffer, uint32_t timestamp) {
    auto kinect_device = static_cast<KinectDevice *>(freenect_get_user(device));
+   // Frames which don't get through the limit are dropped before touching the buffers; freenect then reuses the
+   // same buffer for the next frame.
+   uint32_t const sequence = kinect_device->kinect1_video_sequence++;
+   auto const stream = kinect_device->color_running ? Stream::COLOR : Stream::IR;
+   if (!kinect_device->admit_frame(stream, sequence, std::chrono::steady_clock::now().time_since_epoch())) {
+      return;
+   }
 
    if (buffer != kinect_device->video_buffer_freenect1) {
       throw std::runtime_error("An error occured with Kinect's video buffer.");
@@ -277,42 +477,63 @@ void KinectDevice::kinect1_video_callback(freenect_device *device, void *buffer,
    if (frame_mode.video_format == FREENECT_VIDEO_RGB) {
       auto pixels = new Matrix<Picture::ColorFrame::ColorPixel>(height, width);
       memcpy(pixels->data(), buffer, static_cast<size_t>(frame_mode.bytes));
-      picture.color_frame = new Picture::ColorFrame(pixels);
+      auto color_frame = new Picture::ColorFrame(pixels);
+      color_frame->timestamp = timestamp;
+      color_frame->sequence = sequence;
+      picture.color_frame.reset(color_frame);
    } else if (frame_mode.video_format == FREENECT_VIDEO_IR_10BIT) {
-      auto pixels = new Matrix<float>(height, width);
-      for (size_t i = 0; i < frame_mode.height; ++i) {
-         for (size_t j = 0; j < frame_mode.width; ++j) {
-            (*pixels)[i][j] = float(reinterpret_cast<uint16_t *>(buffer)[frame_mode.width * i + j]);
-         }
-      }
-      picture.ir_frame = new Picture::DepthOrIrFrame(pixels, false);
+      auto pixels = new Matrix<uint16_t>(height, width);
+      memcpy(pixels->data(), buffer, height * width * sizeof(uint16_t));
+      auto ir_frame = new Picture::DepthOrIrFrame(pixels, false);
+      ir_frame->timestamp = timestamp;
+      ir_frame->sequence = sequence;
+      ir_frame->which_kinect = 1;
+      picture.ir_frame.reset(ir_frame);
    } else {
       std::cerr << "kinect1_video_callback() received an unexcepted video format, skipping frame\n";
       return;
    }
-   auto frame_handler_thread = std::thread(&KinectDevice::frame_handler, kinect_device, picture);
-   frame_handler_thread.detach();
+   kinect_device->dispatch_picture(std::move(picture));
+}
+
+std::chrono::nanoseconds kinect2_timestamp_to_duration(uint32_t const timestamp) {
+   // libfreenect2 counts timestamps in units of 0.1 ms.
+   return std::chrono::microseconds(int64_t(timestamp) * 100);
 }
 
 KinectDevice::Kinect2DepthAndIrListener::Kinect2DepthAndIrListener(KinectDevice *kinect_device)
       : kinect_device(kinect_device) {}
 
 bool KinectDevice::Kinect2DepthAndIrListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame) {
-   size_t bytes = frame->width * frame->height * sizeof(float);
-   auto pixels = new Matrix<float>(frame->height, frame->width);
-   memcpy(pixels->data(), frame->data, bytes);
-   Picture picture;
-   if (type == libfreenect2::Frame::Type::Depth) {
-      picture.depth_frame = new Picture::DepthOrIrFrame(pixels, true);
-      picture.depth_frame->freenect2_frame = std::shared_ptr<libfreenect2::Frame>(frame);
-   } else if (type == libfreenect2::Frame::Type::Ir) {
-      picture.ir_frame = new Picture::DepthOrIrFrame(pixels, false);
-      picture.ir_frame->freenect2_frame = std::shared_ptr<libfreenect2::Frame>(frame);
-   } else {
+   if ((type != libfreenect2::Frame::Type::Depth && type != libfreenect2::Frame::Type::Ir)
+         || frame->format != libfreenect2::Frame::Float) {
       std::cerr << "Kinect2DepthAndIrListener::onNewFrame() received an unexcepted video format.\n";
       return false;
    }
-   kinect_device->frame_handler(picture);
+   // Both streams decide on the device's sequence number and timestamp, so that depth and IR frames of one packet
+   // are kept or dropped together. Returning false leaves the frame to libfreenect2.
+   auto const stream = type == libfreenect2::Frame::Type::Depth ? Stream::DEPTH : Stream::IR;
+   if (!kinect_device->admit_frame(stream, frame->sequence, kinect2_timestamp_to_duration(frame->timestamp))) {
+      return false;
+   }
+   // Returning true below hands the frame over to us, so the pixels can be used in place for as long as anything
+   // holds freenect2_frame.
+   auto freenect2_frame = std::shared_ptr<libfreenect2::Frame>(frame);
+   auto pixels =
+         new Matrix<float>(frame->height, frame->width, reinterpret_cast<float *>(frame->data), freenect2_frame);
+   auto depth_or_ir_frame = new Picture::DepthOrIrFrame(pixels, type == libfreenect2::Frame::Type::Depth);
+   depth_or_ir_frame->freenect2_frame = freenect2_frame;
+   depth_or_ir_frame->timestamp = frame->timestamp;
+   depth_or_ir_frame->sequence = frame->sequence;
+   depth_or_ir_frame->which_kinect = 2;
+   depth_or_ir_frame->camera_parameters = std::atomic_load(&kinect_device->camera_parameters);
+   Picture picture;
+   if (depth_or_ir_frame->is_depth) {
+      picture.depth_frame.reset(depth_or_ir_frame);
+   } else {
+      picture.ir_frame.reset(depth_or_ir_frame);
+   }
+   kinect_device->dispatch_picture(std::move(picture));
    return true;
 }
 
@@ -323,22 +544,20 @@ bool KinectDevice::Kinect2ColorListener::onNewFrame(libfreenect2::Frame::Type ty
       std::cerr << "Kinect2ColorListener::onNewFrame received an unexcepted video format.\n";
       return false;
    }
-   auto pixels = new Matrix<Picture::ColorFrame::ColorPixel>(frame->height, frame->width);
-   auto data = static_cast<uint8_t *>(frame->data);
-
-   // Convert BGRX to BGR.
-   for (size_t i = 0; i < frame->height; ++i) {
-      for (size_t j = 0; j < frame->width; ++j) {
-         size_t pixel_index = 4 * (i * frame->width + j);
-         (*pixels)[i][j].blue = data[pixel_index];
-         (*pixels)[i][j].green = data[pixel_index + 1];
-         (*pixels)[i][j].red = data[pixel_index + 2];
-      }
+   if (!kinect_device->admit_frame(
+             Stream::COLOR, frame->sequence, kinect2_timestamp_to_duration(frame->timestamp))) {
+      return false;
    }
+   auto pixels = new Matrix<Picture::ColorFrame::ColorPixel>(frame->height, frame->width);
+   convert_bgrx_to_bgr(static_cast<uint8_t *>(frame->data), reinterpret_cast<uint8_t *>(pixels->data()),
+         frame->height * frame->width);
 
+   auto color_frame = new Picture::ColorFrame(pixels);
+   color_frame->timestamp = frame->timestamp;
+   color_frame->sequence = frame->sequence;
    Picture picture;
-   picture.color_frame = new Picture::ColorFrame(pixels);
-   kinect_device->frame_handler(picture);
+   picture.color_frame.reset(color_frame);
+   kinect_device->dispatch_picture(std::move(picture));
    return false;
 }
 
@@ -17,9 +17,18 @@
    along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 #include <sys/stat.h>
 
 #include <wx/bitmap.h>
@@ -36,8 +45,19 @@
 #include <libfreenect2/registration.h>
 
 #include "basic_types.hpp"
+#include "bitmap_panel.hpp"
+#include "depth_renderer.hpp"
+#include "frame_synchronizer.hpp"
+#include "frame_writer.hpp"
 #include "libkinect.hpp"
+#include "matrix_expression.hpp"
+#include "parallel.hpp"
 #include "picture.hpp"
+#include "point_cloud.hpp"
+#include "recording.hpp"
+#include "replay_source.hpp"
+#include "synthetic_source.hpp"
+#include "triple_buffer.hpp"
 #include <random>
 
 // Constants
@@ -66,23 +86,18 @@ const size_t display_panel_width = 512;
 const size_t display_panel_height = 424;
 const uint32_t default_max_fps = 10;
 
-wxDEFINE_EVENT(REFRESH_DISPLAY_EVENT, wxCommandEvent);
-
 // Declarations
 
-struct Point3d {
-   float x, y, z;
-};
-
-class DisplayPanel : public wxPanel {
-   wxStaticBitmap *m_picture = nullptr;
-
+class DisplayPanel : public BitmapPanel {
  public:
-   DisplayPanel(wxPanel *parent, wxWindowID window_id, uint8_t *bitmap);
+   DisplayPanel(wxPanel *parent, wxWindowID window_id);
 
-   void refresh_display(wxCommandEvent &event);
+   // Written by the render thread, read by the UI thread.
+   TripleBuffer<std::vector<uint8_t>> bitmaps;
 
-   uint8_t *bitmap;
+ protected:
+   // Shows the newest bitmap published by the render thread, if there is one it hasn't shown yet.
+   void refresh_display() override;
 };
 
 class SettingsPanel : public wxPanel {
@@ -98,6 +113,10 @@ class SettingsPanel : public wxPanel {
    void on_fps_button_click(wxCommandEvent &event);
    void on_userid_set_button_click(wxCommandEvent &event);
    void on_userid_random_button_click(wxCommandEvent &event);
+   // Limits every stream of the device to max_fps, so that frames above it aren't even converted.
+   void apply_max_fps();
+   // Copies the sliders' range into min_depth and max_depth.
+   void publish_depth_range();
 
    wxPanel *m_parent;
    wxSlider *m_min_d, *m_max_d;
@@ -105,6 +124,9 @@ class SettingsPanel : public wxPanel {
    wxButton *m_photos_button, *m_exp_button, *m_fps_button, *m_userid_set_button, *m_userid_random_button;
 
    int max_fps = default_max_fps;
+   // The depth range of the sliders, for the render thread, which must not touch the controls.
+   std::atomic<int> min_depth{500}, max_depth{4500};
+   KinectDevice *kinect_device = nullptr;
    std::string userid = "";
    bool taking_photos = false, showing_exp = false;
 };
@@ -113,19 +135,33 @@ class MainWindow : public wxFrame {
    wxPanel *m_parent;
 
  public:
-   explicit MainWindow(const wxString &title, uint8_t *color_bitmap, uint8_t *depth_bitmap, uint8_t *ir_bitmap,
-         uint8_t *custom_bitmap);
+   explicit MainWindow(const wxString &title);
 
    void on_window_close(wxCloseEvent &event);
 
    DisplayPanel *m_display_color, *m_display_depth, *m_display_ir, *m_display_exp;
    bool display_exp_clear = true;
    SettingsPanel *m_settings;
-   Picture *picture;
+   Picture *picture;  // frames last shown, only used by the render thread
    KinectDevice *kinect_device;
 
-   std::chrono::time_point<std::chrono::system_clock> last_shown_color, last_shown_de_ir;
-   Picture::DepthOrIrFrame *buffer_depth, *buffer_ir;
+   std::unique_ptr<FrameSynchronizer> synchronizer;  // pairs depth and IR frames
+   std::unique_ptr<FrameWriter> frame_writer;        // saves photos off the frame handler's thread
+   std::unique_ptr<RecordingWriter> recording;       // set with --record, replaces separate photo files
+   DepthRenderer depth_renderer;                     // range follows the min/max sliders
+   // Used by the reflectiveness view, made on the render thread when it is first turned on.
+   std::unique_ptr<PointCloud> point_cloud;
+   std::unique_ptr<libfreenect2::Registration> registration;  // only with a Kinect v2 device
+   std::unique_ptr<libfreenect2::Frame> undistorted;
+   std::unique_ptr<Matrix<float>> reflectiveness;
+
+   // The frame handler leaves the newest frames to be shown here and the render thread takes them. Frames replaced
+   // before the render thread got to them are never shown.
+   std::mutex render_mutex;
+   std::condition_variable render_wakeup;
+   Picture render_pending;
+   bool render_stopping = false;
+   std::thread render_thread;
 };
 
 // Definitions
@@ -167,6 +203,7 @@ void SettingsPanel::on_min_slider_change(wxCommandEvent &event) {
 
    m_min_d_text->Clear();
    m_min_d_text->WriteText(std::to_string(m_min_d->GetValue()));
+   publish_depth_range();
 }
 
 void SettingsPanel::on_max_slider_change(wxCommandEvent &event) {
@@ -178,6 +215,7 @@ void SettingsPanel::on_max_slider_change(wxCommandEvent &event) {
 
    m_max_d_text->Clear();
    m_max_d_text->WriteText(std::to_string(m_max_d->GetValue()));
+   publish_depth_range();
 }
 
 void SettingsPanel::on_min_text_change(wxCommandEvent &event) {
@@ -192,6 +230,7 @@ void SettingsPanel::on_min_text_change(wxCommandEvent &event) {
       m_max_d_text->Clear();
       m_max_d_text->WriteText(std::to_string(min_d + 1));
    }
+   publish_depth_range();
 }
 
 void SettingsPanel::on_max_text_change(wxCommandEvent &event) {
@@ -206,6 +245,12 @@ void SettingsPanel::on_max_text_change(wxCommandEvent &event) {
       m_min_d_text->Clear();
       m_min_d_text->WriteText(std::to_string(max_d - 1));
    }
+   publish_depth_range();
+}
+
+void SettingsPanel::publish_depth_range() {
+   min_depth = m_min_d->GetValue();
+   max_depth = m_max_d->GetValue();
 }
 
 void SettingsPanel::on_photos_button_click(wxCommandEvent &event) {
@@ -220,10 +265,17 @@ void SettingsPanel::on_exp_button_click(wxCommandEvent &event) {
 
 void SettingsPanel::on_fps_button_click(wxCommandEvent &event) {
    long new_max_fps;
-   if (!m_fps_text->GetValue().ToLong(&new_max_fps)) {
+   if (!m_fps_text->GetValue().ToLong(&new_max_fps) || new_max_fps < 0) {
       return;
    }
    max_fps = static_cast<uint32_t>(new_max_fps);
+   apply_max_fps();
+}
+
+void SettingsPanel::apply_max_fps() {
+   for (auto stream : {KinectDevice::Stream::COLOR, KinectDevice::Stream::DEPTH, KinectDevice::Stream::IR}) {
+      kinect_device->set_stream_limit(stream, 1, max_fps);
+   }
 }
 
 void SettingsPanel::on_userid_set_button_click(wxCommandEvent &event) {
@@ -251,27 +303,23 @@ void SettingsPanel::on_userid_random_button_click(wxCommandEvent &event) {
    userid = std::to_string(new_id);
 }
 
-DisplayPanel::DisplayPanel(wxPanel *parent, wxWindowID window_id, uint8_t *bitmap)
-      : wxPanel(parent, window_id, wxPoint(0, 0), wxSize(display_panel_width, display_panel_height), wxBORDER_SUNKEN),
-        bitmap(bitmap) {
-   Bind(REFRESH_DISPLAY_EVENT, &DisplayPanel::refresh_display, this);
-   wxPostEvent(this, wxCommandEvent(REFRESH_DISPLAY_EVENT));
-}
+DisplayPanel::DisplayPanel(wxPanel *parent, wxWindowID window_id)
+      : BitmapPanel(parent, window_id, display_panel_width, display_panel_height),
+        bitmaps(std::vector<uint8_t>(display_panel_width * display_panel_height * 3, 0)) {}
 
-void DisplayPanel::refresh_display(wxCommandEvent &event) {
-   delete m_picture;
-   m_picture = new wxStaticBitmap(this, wxID_ANY,
-         wxBitmap(wxImage(display_panel_width, display_panel_height, bitmap, true)), wxDefaultPosition, wxDefaultSize);
+void DisplayPanel::refresh_display() {
+   if (bitmaps.update()) {
+      show_pixels(bitmaps.read_buffer().data(), display_panel_width, display_panel_height);
+   }
 }
 
-MainWindow::MainWindow(
-      const wxString &title, uint8_t *color_bitmap, uint8_t *depth_bitmap, uint8_t *ir_bitmap, uint8_t *custom_bitmap)
+MainWindow::MainWindow(const wxString &title)
       : wxFrame(nullptr, wxID_ANY, title, wxDefaultPosition, wxSize(1500, 1050)),
         picture(new Picture(nullptr, nullptr, nullptr)), m_parent(new wxPanel(this, wxID_ANY)),
-        m_display_color(new DisplayPanel(m_parent, ID_DISPLAY_COLOR, color_bitmap)),
-        m_display_depth(new DisplayPanel(m_parent, ID_DISPLAY_DEPTH, depth_bitmap)),
-        m_display_ir(new DisplayPanel(m_parent, ID_DISPLAY_IR, ir_bitmap)),
-        m_display_exp(new DisplayPanel(m_parent, ID_DISPLAY_EXP, custom_bitmap)),
+        m_display_color(new DisplayPanel(m_parent, ID_DISPLAY_COLOR)),
+        m_display_depth(new DisplayPanel(m_parent, ID_DISPLAY_DEPTH)),
+        m_display_ir(new DisplayPanel(m_parent, ID_DISPLAY_IR)),
+        m_display_exp(new DisplayPanel(m_parent, ID_DISPLAY_EXP)),
         m_settings(new SettingsPanel(m_parent)) {
    this->Bind(wxEVT_CLOSE_WINDOW, &MainWindow::on_window_close, this);
 
@@ -292,6 +340,38 @@ MainWindow::MainWindow(
 
 void MainWindow::on_window_close(wxCloseEvent &event) {
    kinect_device->close();
+   {
+      std::lock_guard<std::mutex> lock(render_mutex);
+      render_stopping = true;
+   }
+   render_wakeup.notify_all();
+   if (render_thread.joinable()) {
+      render_thread.join();
+   }
+   if (recording) {
+      recording->close();
+      std::cout << "Frames recorded: " << recording->frame_count() << '\n';
+   }
+   auto statistics = kinect_device->frame_dispatch_statistics();
+   std::cout << "Frames queued: " << statistics.queued << ", dropped: " << statistics.dropped
+             << ", handled: " << statistics.handled << '\n';
+   auto sync_statistics = synchronizer->statistics();
+   std::cout << "Depth/IR pairs: " << sync_statistics.matched << ", match rate: " << sync_statistics.match_rate
+             << '\n';
+   frame_writer->flush();
+   auto writer_statistics = frame_writer->statistics();
+   for (auto stream : {std::make_pair("Color", writer_statistics.color),
+              std::make_pair("Depth", writer_statistics.depth), std::make_pair("IR", writer_statistics.ir)}) {
+      std::cout << stream.first << " files written: " << stream.second.written << ", failed: " << stream.second.failed
+                << ", average latency: " << stream.second.average_latency_ms
+                << " ms, max latency: " << stream.second.max_latency_ms << " ms\n";
+   }
+   std::cout << "Frames over max. FPS dropped - color: " << kinect_device->limited_frames(KinectDevice::Stream::COLOR)
+             << ", depth: " << kinect_device->limited_frames(KinectDevice::Stream::DEPTH)
+             << ", IR: " << kinect_device->limited_frames(KinectDevice::Stream::IR) << '\n';
+   auto pool_statistics = FramePool::instance().statistics();
+   std::cout << "Frame pool hits: " << pool_statistics.hits << ", misses: " << pool_statistics.misses
+             << ", peak bytes: " << pool_statistics.peak_bytes << '\n';
    event.Skip();
 }
 
@@ -306,73 +386,9 @@ std::pair<size_t, size_t> fit_to_size(size_t width, size_t height, size_t max_wi
    }
 }
 
-template <typename VectorT, typename ElementT = double>
-ElementT euclidian_norm(VectorT const vector) {
-   size_t length = 0;
-   ElementT ret = 0;
-
-   for (auto const &x : vector) {
-      ret += x * x;
-   }
-
-   return std::sqrt(ret);
-}
-
-template <typename VectorT, typename ElementT = double>
-ElementT vector_dot(VectorT const &v, VectorT const &w) {
-   if (v.size() != w.size()) {
-      throw std::invalid_argument("v.size != w.size // TODO explanation?");
-   }
-
-   ElementT ret = 0;
-   for (size_t i = 0; i < v.size(); ++i) {
-      ret += v[i] * w[i];
-   }
-
-   return ret;
-}
-
-double calculate_reflectiveness_for_surface(std::array<std::array<Point3d const, 3>, 3> const square) {
-   /*std::cerr << "square" << std::endl;
-   for(auto row : square) {
-      for(auto x : row)
-        std::cerr << "(" << x.x << ", " << x.y << ", " << x.z <<"),  ";
-      std::cerr << std::endl;
-   }*/
-
-   std::array<double, 3> v1{
-         {square[1][0].x - square[1][1].x, square[1][0].y - square[1][1].y, square[1][0].z - square[1][1].z}},
-         w1{{square[1][2].x - square[1][1].x, square[1][2].y - square[1][1].y, square[1][2].z - square[1][1].z}};
-
-   std::array<double, 3> v2{
-         {square[0][1].x - square[1][1].x, square[0][1].y - square[1][1].y, square[0][1].z - square[1][1].z}},
-         w2{{square[2][1].x - square[1][1].x, square[2][1].y - square[1][1].y, square[2][1].z - square[1][1].z}};
-
-   double const cos1 = vector_dot(v1, w1) / (euclidian_norm(v1) * euclidian_norm(w1));
-   double const cos2 = vector_dot(v2, w2) / (euclidian_norm(v2) * euclidian_norm(w2));
-
-   if (cos1 != cos1 || cos2 != cos2) {
-      return 2.0;
-   }
-
-   double const ang = (std::acos(cos1) + std::acos(cos2)) / 3.14;
-
-   return ang < 0.25 ? 0.5 : 2 * ang;
-}
-
 std::string make_filename(
       int which_kinect, std::chrono::time_point<std::chrono::system_clock> time_point, std::string user_id) {
-   auto time_point_as_time_t = std::chrono::system_clock::to_time_t(time_point);
-   char current_time_char[100];
-   std::strftime(current_time_char, sizeof(current_time_char), "%Y-%m-%d-%H-%M-%S", std::gmtime(&time_point_as_time_t));
-   std::string current_time_string = current_time_char;
-
-   current_time_string += '-';
-   std::string milliseconds = std::to_string(
-         std::chrono::duration_cast<std::chrono::milliseconds>(time_point.time_since_epoch()).count() % 1000);
-   current_time_string += std::string(3 - milliseconds.length(), '0') + milliseconds;
-
-   return photos_directory + user_id + "/" + current_time_string + "-kinect" + std::to_string(which_kinect);
+   return photos_directory + user_id + "/" + capture_basename(which_kinect, time_point);
 }
 
 // Kinect handling
@@ -380,153 +396,148 @@ std::string make_filename(
 class MyKinectDevice : public KinectDevice {
  public:
    explicit MyKinectDevice(int device_number) : KinectDevice(device_number) {}
+   explicit MyKinectDevice(std::unique_ptr<FrameSource> frame_source) : KinectDevice(std::move(frame_source)) {}
 
+   // Saves photos and passes the frames to be shown on to the render thread.
    void frame_handler(Picture const &picture) const override;
+   // Runs on the render thread until the window is closed.
+   void render_loop() const;
+   // Draws the frames into the display panels' bitmaps.
+   void render(Picture const &frames) const;
+   // Appends the photo to the recording if there is one, saves it to separate files otherwise.
+   void save_photo(Picture photo, std::chrono::time_point<std::chrono::system_clock> time_received) const;
 
    MainWindow *window = nullptr;
+
+ private:
+   void publish_for_render(Picture const &frames) const;
 };
 
-void MyKinectDevice::frame_handler(Picture const &picture) const {
-   if (window == nullptr) {
-      return;
+void MyKinectDevice::save_photo(
+      Picture photo, std::chrono::time_point<std::chrono::system_clock> const time_received) const {
+   if (window->recording) {
+      window->recording->append(photo);
+   } else {
+      window->frame_writer->save(
+            std::move(photo), make_filename(which_kinect, time_received, window->m_settings->userid));
    }
+}
 
-   if (picture.color_frame
-         && picture.color_frame->time_received - window->last_shown_color
-                  >= std::chrono::milliseconds(1000 / window->m_settings->max_fps)) {
-
-      window->last_shown_color = std::chrono::system_clock::now();
-
-      if (window->m_settings->taking_photos) {
-         std::string filename =
-               make_filename(which_kinect, picture.color_frame->time_received, window->m_settings->userid);
-         picture.color_frame->save_to_file(filename + ".png");
+void MyKinectDevice::publish_for_render(Picture const &frames) const {
+   {
+      std::lock_guard<std::mutex> lock(window->render_mutex);
+      if (frames.color_frame) {
+         window->render_pending.color_frame = frames.color_frame;
       }
-
-      delete window->picture->color_frame;
-      window->picture->color_frame = new Picture::ColorFrame(*picture.color_frame);
-
-      auto frame_size = fit_to_size(window->picture->color_frame->pixels->width,
-            window->picture->color_frame->pixels->height, display_panel_width, display_panel_height);
-      size_t frame_width = frame_size.first;
-      size_t frame_height = frame_size.second;
-
-      if (frame_width != window->picture->color_frame->pixels->width
-            || frame_height != window->picture->color_frame->pixels->height) {
-         window->picture->color_frame->resize(frame_width, frame_height);
+      if (frames.depth_frame) {
+         window->render_pending.depth_frame = frames.depth_frame;
       }
-
-      for (size_t i = 0; i < frame_height; ++i) {
-         for (size_t j = 0; j < frame_width; ++j) {
-            window->m_display_color->bitmap[3 * (i * display_panel_width + j)] =
-                  (*window->picture->color_frame->pixels)[i][j].red;
-            window->m_display_color->bitmap[3 * (i * display_panel_width + j) + 1] =
-                  (*window->picture->color_frame->pixels)[i][j].green;
-            window->m_display_color->bitmap[3 * (i * display_panel_width + j) + 2] =
-                  (*window->picture->color_frame->pixels)[i][j].blue;
-         }
+      if (frames.ir_frame) {
+         window->render_pending.ir_frame = frames.ir_frame;
       }
-
-      wxPostEvent(window->m_display_color, wxCommandEvent(REFRESH_DISPLAY_EVENT));
    }
+   window->render_wakeup.notify_one();
+}
 
-   if (picture.depth_frame) {
-      delete window->buffer_depth;
-      window->buffer_depth = new Picture::DepthOrIrFrame(*picture.depth_frame);
-   } else if (picture.ir_frame) {
-      delete window->buffer_ir;
-      window->buffer_ir = new Picture::DepthOrIrFrame(*picture.ir_frame);
+void MyKinectDevice::frame_handler(Picture const &picture) const {
+   if (window == nullptr) {
+      return;
    }
 
-   Picture::DepthOrIrFrame *depth_frame = window->buffer_depth, *ir_frame = window->buffer_ir;
+   // Frames above max_fps have already been dropped by the device.
+   if (picture.color_frame) {
+      Picture color_only;
+      color_only.color_frame = picture.color_frame;
+      if (window->m_settings->taking_photos) {
+         save_photo(color_only, picture.color_frame->time_received);
+      }
+      publish_for_render(color_only);
+   }
 
-   if (!depth_frame || !ir_frame) {
+   Picture frames;
+   if (!window->synchronizer->push(picture, frames)) {
       return;
    }
 
-   if (std::min(depth_frame->time_received, ir_frame->time_received) - window->last_shown_de_ir
-         < std::chrono::milliseconds(1000 / window->m_settings->max_fps)) {
-      return;
+   if (window->m_settings->taking_photos) {
+      Picture depth_only, ir_only;
+      depth_only.depth_frame = frames.depth_frame;
+      ir_only.ir_frame = frames.ir_frame;
+      save_photo(std::move(depth_only), frames.depth_frame->time_received);
+      save_photo(std::move(ir_only), frames.ir_frame->time_received);
    }
+   publish_for_render(frames);
+}
 
-   if (depth_frame->time_received - ir_frame->time_received > std::chrono::milliseconds(5)
-         || depth_frame->time_received - ir_frame->time_received < std::chrono::milliseconds(-5)) {
-      return;
+void MyKinectDevice::render_loop() const {
+   while (true) {
+      Picture frames;
+      {
+         std::unique_lock<std::mutex> lock(window->render_mutex);
+         window->render_wakeup.wait(lock, [this] {
+            auto const &pending = window->render_pending;
+            return window->render_stopping || pending.color_frame || pending.depth_frame || pending.ir_frame;
+         });
+         if (window->render_stopping) {
+            return;
+         }
+         std::swap(frames, window->render_pending);
+      }
+      try {
+         render(frames);
+      } catch (std::exception const &e) {
+         std::cerr << "render() threw an exception: " << e.what() << '\n';
+      }
    }
+}
+
+void MyKinectDevice::render(Picture const &frames) const {
+   if (frames.color_frame) {
+      window->picture->color_frame = frames.color_frame;
+      auto frame_size = fit_to_size(window->picture->color_frame->pixels->width,
+            window->picture->color_frame->pixels->height, display_panel_width, display_panel_height);
 
-   window->last_shown_de_ir = std::chrono::system_clock::now();
+      // Nothing else uses the color frame at display size, so it's scaled straight into the bitmap.
+      window->picture->color_frame->resize_to_bitmap(window->m_display_color->bitmaps.write_buffer().data(),
+            display_panel_width, frame_size.first, frame_size.second);
 
-   if (!depth_frame->is_depth || ir_frame->is_depth) {
-      throw std::runtime_error("Something went wrong with buffering frames.");
+      window->m_display_color->bitmaps.publish();
+      window->m_display_color->request_refresh();
    }
 
-   if (true) {
-      if (window->m_settings->taking_photos) {
-         std::string filename = make_filename(which_kinect, depth_frame->time_received, window->m_settings->userid);
-         depth_frame->save_to_file(filename + ".depth");
-      }
+   CowPtr<Picture::DepthOrIrFrame> depth_frame = frames.depth_frame, ir_frame = frames.ir_frame;
 
-      delete window->picture->depth_frame;
-      window->picture->depth_frame = new Picture::DepthOrIrFrame(*depth_frame);
+   if (depth_frame) {
+      window->picture->depth_frame = depth_frame;
 
-      auto frame_size = fit_to_size(window->picture->depth_frame->pixels->width,
-            window->picture->depth_frame->pixels->height, display_panel_width, display_panel_height);
+      auto frame_size = fit_to_size(window->picture->depth_frame->width(), window->picture->depth_frame->height(),
+            display_panel_width, display_panel_height);
       size_t frame_width = frame_size.first;
       size_t frame_height = frame_size.second;
 
-      if (frame_width != window->picture->depth_frame->pixels->width
-            || frame_height != window->picture->depth_frame->pixels->height) {
-         window->picture->depth_frame->resize(frame_width, frame_height);
-      }
-
-      float min_depth = window->m_settings->m_min_d->GetValue(), max_depth = window->m_settings->m_max_d->GetValue();
-      if (max_depth - min_depth < 1.0) {
-         max_depth = min_depth + 1.0f;
-      }
-
-      auto int_pixels = new uint8_t[frame_width * frame_height];
-      for (size_t i = 0; i < frame_width * frame_height; ++i) {
-         int_pixels[i] = uint8_t(std::max(0.0,
-               std::min(255.0 * (window->picture->depth_frame->pixels->data()[i] - min_depth) / (max_depth - min_depth),
-                                                255.0)));
-      }
-
-      cv::Mat current_image(
-            cv::Size(static_cast<int>(frame_width), static_cast<int>(frame_height)), CV_8UC1, int_pixels);
-      cv::Mat destination_image(cv::Size(static_cast<int>(frame_width), static_cast<int>(frame_height)), CV_8UC3);
-      cv::applyColorMap(current_image, destination_image, cv::COLORMAP_RAINBOW);
-
-      for (size_t i = 0; i < frame_height; ++i) {
-         for (size_t j = 0; j < frame_width; ++j) {
-            auto pixel = destination_image.at<cv::Vec3b>(static_cast<int>(i), static_cast<int>(j));
-            window->m_display_depth->bitmap[3 * (i * display_panel_width + j)] = pixel[2];
-            window->m_display_depth->bitmap[3 * (i * display_panel_width + j) + 1] = pixel[1];
-            window->m_display_depth->bitmap[3 * (i * display_panel_width + j) + 2] = pixel[0];
-         }
+      if (frame_width != window->picture->depth_frame->width()
+            || frame_height != window->picture->depth_frame->height()) {
+         window->picture->depth_frame.mutate()->resize(frame_width, frame_height);
       }
 
-      delete[] int_pixels;
+      window->depth_renderer.set_range(window->m_settings->min_depth, window->m_settings->max_depth);
+      window->depth_renderer.render(
+            *window->picture->depth_frame, window->m_display_depth->bitmaps.write_buffer().data(), display_panel_width);
 
-      wxPostEvent(window->m_display_depth, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+      window->m_display_depth->bitmaps.publish();
+      window->m_display_depth->request_refresh();
    }
 
-   if (true) {
-      if (window->m_settings->taking_photos) {
-         std::string filename = make_filename(which_kinect, ir_frame->time_received, window->m_settings->userid);
-         ir_frame->save_to_file(filename + ".ir");
-      }
-
-      delete window->picture->ir_frame;
-      window->picture->ir_frame = new Picture::DepthOrIrFrame(*ir_frame);
+   if (ir_frame) {
+      window->picture->ir_frame = ir_frame;
 
-      auto frame_size = fit_to_size(window->picture->ir_frame->pixels->width, window->picture->ir_frame->pixels->height,
+      auto frame_size = fit_to_size(window->picture->ir_frame->width(), window->picture->ir_frame->height(),
             display_panel_width, display_panel_height);
       size_t frame_width = frame_size.first;
       size_t frame_height = frame_size.second;
 
-      if (frame_width != window->picture->ir_frame->pixels->width
-            || frame_height != window->picture->ir_frame->pixels->height) {
-         window->picture->ir_frame->resize(frame_width, frame_height);
+      if (frame_width != window->picture->ir_frame->width() || frame_height != window->picture->ir_frame->height()) {
+         window->picture->ir_frame.mutate()->resize(frame_width, frame_height);
       }
 
       float max_value;
@@ -536,104 +547,88 @@ void MyKinectDevice::frame_handler(Picture const &picture) const {
          max_value = 65535.0;
       }
 
-      for (size_t i = 0; i < frame_height; ++i) {
-         for (size_t j = 0; j < frame_width; ++j) {
-            auto pixel_value = static_cast<uint8_t>(255.0 * (*window->picture->ir_frame->pixels)[i][j] / max_value);
-            window->m_display_ir->bitmap[3 * (i * display_panel_width + j)] = pixel_value;
-            window->m_display_ir->bitmap[3 * (i * display_panel_width + j) + 1] = pixel_value;
-            window->m_display_ir->bitmap[3 * (i * display_panel_width + j) + 2] = pixel_value;
-         }
-      }
+      auto bitmap = bitmap_view(
+            window->m_display_ir->bitmaps.write_buffer().data(), display_panel_width, frame_height, frame_width);
+      window->picture->ir_frame->visit_pixels([&](auto const &pixels) {
+         auto const gray = [](uint8_t const value) { return BitmapPixel{value, value, value}; };
+         evaluate(elementwise(gray, cast<uint8_t>(255.0f * pixels / max_value)), bitmap);
+      });
 
-      wxPostEvent(window->m_display_ir, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+      window->m_display_ir->bitmaps.publish();
+      window->m_display_ir->request_refresh();
    }
 
    if (!window->m_settings->showing_exp && !window->display_exp_clear) {
+      uint8_t *bitmap = window->m_display_exp->bitmaps.write_buffer().data();
       for (size_t i = 0; i < display_panel_height; ++i) {
          for (size_t j = 0; j < display_panel_width; ++j) {
             for (size_t k = 0; k < 3; ++k) {
-               window->m_display_exp->bitmap[3 * (i * display_panel_width + j) + k] = 0;
+               bitmap[3 * (i * display_panel_width + j) + k] = 0;
             }
          }
       }
 
       window->display_exp_clear = true;
 
-      wxPostEvent(window->m_display_exp, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+      window->m_display_exp->bitmaps.publish();
+      window->m_display_exp->request_refresh();
    }
 
    if (window->m_settings->showing_exp && (depth_frame || ir_frame) && window->picture->depth_frame
-         && window->picture->ir_frame
-         && window->picture->depth_frame->pixels->width == window->picture->ir_frame->pixels->width
-         && window->picture->depth_frame->pixels->height == window->picture->ir_frame->pixels->height) {
-      auto frame_width = window->picture->depth_frame->pixels->width,
-           frame_height = window->picture->depth_frame->pixels->height;
-
-      Matrix<double> values(frame_height, frame_width);
-      double max_value = 0.0;
-
-      libfreenect2::Registration registration(
-            freenect2_device->getIrCameraParams(), freenect2_device->getColorCameraParams());
-      // TODO: need to double check the impact of undistortDepth on the depth frame.
-      libfreenect2::Frame undistorted(frame_width, frame_height, 4);
-      registration.undistortDepth(window->picture->depth_frame->freenect2_frame.get(), &undistorted);
-      Matrix<Point3d> points(frame_height, frame_width);
-      Matrix<double> distance(frame_height, frame_width);
-
-      for (size_t i = 0; i < frame_height; ++i) {
-         for (size_t j = 0; j < frame_width; ++j) {
-            distance[i][j] = reinterpret_cast<float const *>(undistorted.data)[i * frame_width + j];
-         }
-      }
-
-      for (size_t i = 0; i < frame_height; ++i) {
-         for (size_t j = 0; j < frame_width; ++j) {
-            registration.getPointXYZ(&undistorted, static_cast<int>(i), static_cast<int>(j), points[i][j].x,
-                  points[i][j].y, points[i][j].z);
+         && window->picture->ir_frame && window->picture->depth_frame->width() == window->picture->ir_frame->width()
+         && window->picture->depth_frame->height() == window->picture->ir_frame->height()) {
+      auto frame_width = window->picture->depth_frame->width(), frame_height = window->picture->depth_frame->height();
+      auto const &ir_pixels = window->picture->ir_frame->float_pixels();
+
+      // The registration and the ray tables only depend on the camera, so they are made once.
+      if (!window->point_cloud || window->point_cloud->width != frame_width
+            || window->point_cloud->height != frame_height) {
+         CameraIntrinsics intrinsics = kinect2_default_ir_intrinsics;
+         if (freenect2_device != nullptr) {
+            auto ir_parameters = freenect2_device->getIrCameraParams();
+            intrinsics = CameraIntrinsics{ir_parameters.fx, ir_parameters.fy, ir_parameters.cx, ir_parameters.cy};
+            window->registration.reset(
+                  new libfreenect2::Registration(ir_parameters, freenect2_device->getColorCameraParams()));
+            window->undistorted.reset(new libfreenect2::Frame(frame_width, frame_height, 4));
+         } else if (window->picture->depth_frame->camera_parameters) {
+            // Replayed frames saved with their device's parameters.
+            auto const &ir_parameters = window->picture->depth_frame->camera_parameters->ir;
+            intrinsics = CameraIntrinsics{ir_parameters.fx, ir_parameters.fy, ir_parameters.cx, ir_parameters.cy};
          }
+         window->point_cloud.reset(new PointCloud(frame_width, frame_height, intrinsics));
+         window->reflectiveness.reset(new Matrix<float>(frame_height, frame_width));
       }
 
-      for (size_t i = 0; i < frame_height; ++i) {
-         for (size_t j = 0; j < frame_width; ++j) {
-            values[i][j] = distance[i][j] * distance[i][j] * (*window->picture->ir_frame->pixels)[i][j];
-
-            if (i > 0 && j > 0 && i + 1 < frame_height && j + 1 < frame_width) {
-               double reflectiveness = calculate_reflectiveness_for_surface(
-                     {{{points[i - 1][j - 1], points[i - 1][j], points[i - 1][j + 1]},
-                           {points[i + 0][j - 1], points[i + 0][j], points[i + 0][j + 1]},
-                           {points[i + 1][j - 1], points[i + 1][j], points[i + 1][j + 1]}}});
-               values[i][j] /= reflectiveness;
-
-               max_value = std::max(max_value, values[i][j]);
-            }
-         }
+      // Frames which didn't come from libfreenect2 (e.g. replayed ones) are used without undistortion.
+      float const *distance = window->picture->depth_frame->float_pixels().data();
+      if (window->registration && window->picture->depth_frame->freenect2_frame) {
+         // TODO: need to double check the impact of undistortDepth on the depth frame.
+         window->registration->undistortDepth(
+               window->picture->depth_frame->freenect2_frame.get(), window->undistorted.get());
+         distance = reinterpret_cast<float const *>(window->undistorted->data);
       }
+      window->point_cloud->compute(distance);
+      Matrix<float> &reflectiveness = *window->reflectiveness;
+      window->point_cloud->surface_reflectiveness(reflectiveness);
 
-      // std::cerr << max_value << '\n';
       // This is a constant because otherwise the display flickers depending on the actual max value.
-      // Uncoment the cerr above if you need to determine a new one after changing how it's calculated.
-      max_value = 2e10;
-
-      for (size_t i = 0; i < frame_height; ++i) {
-         for (size_t j = 0; j < frame_width; ++j) {
-            auto pixel_value = static_cast<uint8_t>(std::min(255.0, 255.0 * values[i][j] / max_value));
-            float min_red = 255.0f * static_cast<float>(window->m_settings->m_min_d->GetValue()) / 10000.0f;
-            float max_red = 255.0f * static_cast<float>(window->m_settings->m_max_d->GetValue()) / 10000.0f;
-            if (pixel_value >= min_red && pixel_value <= max_red) {
-               window->m_display_exp->bitmap[3 * (i * display_panel_width + j)] = 255;
-               window->m_display_exp->bitmap[3 * (i * display_panel_width + j) + 1] = 0;
-               window->m_display_exp->bitmap[3 * (i * display_panel_width + j) + 2] = 0;
-            } else {
-               window->m_display_exp->bitmap[3 * (i * display_panel_width + j)] = pixel_value;
-               window->m_display_exp->bitmap[3 * (i * display_panel_width + j) + 1] = pixel_value;
-               window->m_display_exp->bitmap[3 * (i * display_panel_width + j) + 2] = pixel_value;
-            }
-         }
-      }
+      float const max_value = 2e10f;
+      float const min_red = 255.0f * static_cast<float>(window->m_settings->min_depth) / 10000.0f;
+      float const max_red = 255.0f * static_cast<float>(window->m_settings->max_depth) / 10000.0f;
+
+      // distance * distance * IR / reflectiveness, scaled to a byte, with the values between the sliders in red.
+      MatrixView<float const> const distance_view(distance, frame_height, frame_width, frame_width);
+      auto const value = distance_view * distance_view * ir_pixels / reflectiveness;
+      auto const pixel_value = cast<uint8_t>(clamp(255.0f * value / max_value, 0.0f, 255.0f));
+      auto const gray = elementwise([](uint8_t const v) { return BitmapPixel{v, v, v}; }, pixel_value);
+      evaluate(select(pixel_value >= min_red && pixel_value <= max_red, constant(BitmapPixel{255, 0, 0}), gray),
+            bitmap_view(window->m_display_exp->bitmaps.write_buffer().data(), display_panel_width, frame_height,
+                  frame_width));
 
       window->display_exp_clear = false;
 
-      wxPostEvent(window->m_display_exp, wxCommandEvent(REFRESH_DISPLAY_EVENT));
+      window->m_display_exp->bitmaps.publish();
+      window->m_display_exp->request_refresh();
    }
 }
 
@@ -643,32 +638,86 @@ class AppMain : public wxApp {
  public:
    bool OnInit() override;
    MyKinectDevice *kinect_device = nullptr;
+   std::string recording_filename;
+   DepthCompression photo_compression = DepthCompression::GZIP;
 };
 
 bool AppMain::OnInit() {
-   auto *color_bitmap = new uint8_t[display_panel_width * display_panel_height * 3];
-   auto *depth_bitmap = new uint8_t[display_panel_width * display_panel_height * 3];
-   auto *ir_bitmap = new uint8_t[display_panel_width * display_panel_height * 3];
-   auto *custom_bitmap = new uint8_t[display_panel_width * display_panel_height * 3];
-   for (size_t i = 0; i < display_panel_width * display_panel_height * 3; ++i) {
-      color_bitmap[i] = 0;
-      depth_bitmap[i] = 0;
-      ir_bitmap[i] = 0;
-      custom_bitmap[i] = 0;
-   }
-
-   MainWindow *window =
-         new MainWindow(wxT("Live Kinect display"), color_bitmap, depth_bitmap, ir_bitmap, custom_bitmap);
+   MainWindow *window = new MainWindow(wxT("Live Kinect display"));
    window->kinect_device = kinect_device;
+   // Kinect v2 depth and IR frames come from the same packet and share its sequence number.
+   window->synchronizer.reset(new FrameSynchronizer(false, true, true,
+         kinect_device->which_kinect == 2 ? SyncKey::SEQUENCE : SyncKey::TIMESTAMP));
+   window->frame_writer.reset(new FrameWriter(2, 32, OverflowPolicy::BLOCK, photo_compression));
+   if (!recording_filename.empty()) {
+      window->recording.reset(new RecordingWriter(recording_filename, kinect_device->which_kinect));
+   }
    window->Show(true);
 
    kinect_device->window = window;
+   window->m_settings->kinect_device = kinect_device;
+   window->m_settings->apply_max_fps();
+   window->render_thread = std::thread(&MyKinectDevice::render_loop, kinect_device);
 
    return true;
 }
 
 int main(int argc, char **argv) {
-   auto kinect_device = new MyKinectDevice(0);
+   std::string recording_filename, replay_path;
+   DepthCompression photo_compression = DepthCompression::GZIP;
+   auto replay_timing = ReplayTiming::ORIGINAL;
+   bool replay_loop = false;
+   bool synthetic = false;
+   SyntheticSettings synthetic_settings;
+   for (int i = 1; i < argc; ++i) {
+      std::string argument = argv[i];
+      if (argument == "--record" && i + 1 < argc) {
+         recording_filename = argv[++i];
+      } else if (argument == "--replay" && i + 1 < argc) {
+         replay_path = argv[++i];
+      } else if (argument == "--fast") {
+         replay_timing = ReplayTiming::AS_FAST_AS_POSSIBLE;
+      } else if (argument == "--loop") {
+         replay_loop = true;
+      } else if (argument == "--synthetic" && i + 1 < argc) {
+         synthetic = true;
+         std::string scene = argv[++i];
+         if (scene == "face") {
+            synthetic_settings.scene = SyntheticScene::FACE;
+         } else {
+            synthetic_settings.scene = SyntheticScene::SPHERES;
+            synthetic_settings.sphere_count = std::max(1, std::atoi(scene.c_str()));
+         }
+      } else if (argument == "--fps" && i + 1 < argc) {
+         synthetic_settings.fps = std::atof(argv[++i]);
+      } else if (argument == "--color-size" && i + 1 < argc) {
+         if (std::sscanf(argv[++i], "%zux%zu", &synthetic_settings.color_width, &synthetic_settings.color_height)
+               != 2) {
+            std::cerr << "--color-size expects WIDTHxHEIGHT\n";
+            return 1;
+         }
+      } else if (argument == "--depth-size" && i + 1 < argc) {
+         if (std::sscanf(argv[++i], "%zux%zu", &synthetic_settings.depth_width, &synthetic_settings.depth_height)
+               != 2) {
+            std::cerr << "--depth-size expects WIDTHxHEIGHT\n";
+            return 1;
+         }
+      } else if (argument == "--kinect1") {
+         synthetic_settings.which_kinect = 1;
+      } else if (argument == "--depth-codec") {
+         photo_compression = DepthCompression::CODEC;
+      }
+   }
+
+   MyKinectDevice *kinect_device;
+   if (synthetic) {
+      kinect_device = new MyKinectDevice(std::unique_ptr<FrameSource>(new SyntheticSource(synthetic_settings)));
+   } else if (replay_path.empty()) {
+      kinect_device = new MyKinectDevice(0);
+   } else {
+      kinect_device = new MyKinectDevice(
+            std::unique_ptr<FrameSource>(new ReplaySource(replay_path, replay_timing, replay_loop)));
+   }
    bool use_color, use_depth, use_ir;
    if (kinect_device->which_kinect == 1) {
       use_color = false;
@@ -683,6 +732,8 @@ int main(int argc, char **argv) {
 
    auto app = new AppMain();
    app->kinect_device = kinect_device;
+   app->recording_filename = recording_filename;
+   app->photo_compression = photo_compression;
    wxApp::SetInstance(app);
    return wxEntry(argc, argv);
 }
@@ -0,0 +1,400 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MATRIX_EXPRESSION_HPP
+#define MATRIX_EXPRESSION_HPP
+
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "basic_types.hpp"
+#include "parallel.hpp"
+
+// Declarations
+
+// Element-wise arithmetic on matrices which computes nothing until it is evaluated. Operators on Matrix, MatrixView,
+// scalars and other expressions only build a tree of small objects; evaluate() then walks the destination once and
+// computes each pixel from the whole tree, without buffers for the intermediate results:
+//
+//    evaluate(cast<uint8_t>(clamp(255.0f * (depth - min) / (max - min), 0.0f, 255.0f)), bytes);
+//
+// Expressions see matrices through views, so the matrices have to outlive them. Scalars are copied. Operands follow
+// the usual C++ promotions, e.g. a Matrix<uint16_t> times a float gives floats.
+
+// Base of all expressions. Derived has:
+//  - bool fits(size_t height, size_t width) const, whether all its matrices are of that size,
+//  - row(size_t i) const, returning something whose operator[](j) is the value of the pixel (i, j).
+template <typename Derived>
+class MatrixExpression {
+ public:
+   Derived const &derived() const;
+};
+
+// A matrix or a view inside an expression.
+template <typename ElementType>
+class MatrixTerminal : public MatrixExpression<MatrixTerminal<ElementType>> {
+ public:
+   explicit MatrixTerminal(MatrixView<ElementType const> view);
+
+   bool fits(size_t height, size_t width) const;
+   ElementType const *row(size_t i) const;
+
+ private:
+   MatrixView<ElementType const> view;
+};
+
+// The same value for every pixel.
+template <typename ValueType>
+class ScalarTerminal : public MatrixExpression<ScalarTerminal<ValueType>> {
+ public:
+   struct Row {
+      ValueType operator[](size_t j) const;
+      ValueType value;
+   };
+
+   explicit ScalarTerminal(ValueType value);
+
+   bool fits(size_t height, size_t width) const;
+   Row row(size_t i) const;
+
+ private:
+   ValueType value;
+};
+
+// operation(operands[i][j]...) for every pixel. The operation should be cheap to copy and shouldn't branch on the
+// values, so that evaluate() can vectorize its loop.
+template <typename Operation, typename... Operands>
+class MatrixMap : public MatrixExpression<MatrixMap<Operation, Operands...>> {
+ public:
+   template <typename... RowTypes>
+   struct Row {
+      auto operator[](size_t j) const;
+
+      Operation operation;
+      std::tuple<RowTypes...> rows;
+   };
+
+   explicit MatrixMap(Operation operation, Operands... operands);
+
+   bool fits(size_t height, size_t width) const;
+   auto row(size_t i) const;
+
+ private:
+   Operation operation;
+   std::tuple<Operands...> operands;
+};
+
+// Whether T can be an operand: an expression, a Matrix, a MatrixView or (only next to one of those) an arithmetic
+// scalar.
+template <typename T>
+struct is_matrix_operand;
+template <typename T>
+struct is_scalar_operand : std::is_arithmetic<T> {};
+
+// The expression standing for an operand.
+template <typename Derived>
+Derived const &to_expression(MatrixExpression<Derived> const &expression);
+template <typename ElementType>
+MatrixTerminal<ElementType> to_expression(Matrix<ElementType> const &matrix);
+template <typename ElementType>
+MatrixTerminal<std::remove_const_t<ElementType>> to_expression(MatrixView<ElementType> view);
+template <typename ValueType, typename = std::enable_if_t<is_scalar_operand<ValueType>::value>>
+ScalarTerminal<ValueType> to_expression(ValueType value);
+
+// For scalars which can't be operands by themselves, e.g. a pixel struct.
+template <typename ValueType>
+ScalarTerminal<ValueType> constant(ValueType value);
+
+template <typename T>
+using expression_type = std::decay_t<decltype(to_expression(std::declval<T const &>()))>;
+
+// Enables the operators when all their operands can be in an expression and at least one of them isn't a scalar.
+template <typename Result, typename... Operands>
+using enable_for_matrix_operands = std::enable_if_t<
+      std::conjunction<std::disjunction<is_matrix_operand<Operands>, is_scalar_operand<Operands>>...>::value
+            && std::disjunction<is_matrix_operand<Operands>...>::value,
+      Result>;
+
+// function(operands[i][j]...) for every pixel, for operations which have no operator of their own.
+template <typename Function, typename... Operands>
+MatrixMap<Function, expression_type<Operands>...> elementwise(Function function, Operands const &... operands);
+
+// Element-wise +, -, *, /, <, <=, >, >=, ==, !=, && and || with two operands and - with one, defined below. Like
+// those of std::valarray, && and || evaluate both sides.
+template <typename Operand>
+enable_for_matrix_operands<MatrixMap<std::negate<>, expression_type<Operand>>, Operand> operator-(
+      Operand const &operand);
+
+struct ClampOperation {
+   template <typename ValueType, typename LowType, typename HighType>
+   auto operator()(ValueType value, LowType low, HighType high) const;
+};
+
+// The value limited to [low, high], in their common type. NaN stays NaN.
+template <typename Operand, typename Low, typename High>
+enable_for_matrix_operands<MatrixMap<ClampOperation, expression_type<Operand>, expression_type<Low>,
+                                 expression_type<High>>,
+      Operand, Low, High>
+clamp(Operand const &operand, Low const &low, High const &high);
+
+template <typename ResultType>
+struct CastOperation {
+   template <typename ValueType>
+   ResultType operator()(ValueType value) const;
+};
+
+// static_cast<ResultType> of every pixel. As with static_cast, values out of ResultType's range are undefined for
+// integer results, so clamp them first.
+template <typename ResultType, typename Operand>
+enable_for_matrix_operands<MatrixMap<CastOperation<ResultType>, expression_type<Operand>>, Operand> cast(
+      Operand const &operand);
+
+struct SelectOperation {
+   template <typename ConditionType, typename TrueType, typename FalseType>
+   auto operator()(ConditionType condition, TrueType if_true, FalseType if_false) const;
+};
+
+// if_true where the condition holds, if_false elsewhere. Both are computed for every pixel, which lets the choice
+// be made without branching.
+template <typename Condition, typename IfTrue, typename IfFalse>
+enable_for_matrix_operands<MatrixMap<SelectOperation, expression_type<Condition>, expression_type<IfTrue>,
+                                 expression_type<IfFalse>>,
+      Condition, IfTrue, IfFalse>
+select(Condition const &condition, IfTrue const &if_true, IfFalse const &if_false);
+
+enum class Execution {
+   SEQUENTIAL,
+   PARALLEL  // in bands of rows on the default thread pool
+};
+
+// Sets every pixel of the destination to static_cast<ElementType> of the expression's value there, in one pass over
+// it. Throws std::invalid_argument if the expression's matrices aren't of the destination's size. The destination
+// may be one of the expression's matrices, each pixel is only read before it is written.
+template <typename Expression, typename ElementType>
+void evaluate(MatrixExpression<Expression> const &expression, MatrixView<ElementType> destination,
+      Execution execution = Execution::PARALLEL);
+template <typename Expression, typename ElementType>
+void evaluate(MatrixExpression<Expression> const &expression, Matrix<ElementType> &destination,
+      Execution execution = Execution::PARALLEL);
+
+// Definitions - expressions
+
+template <typename Derived>
+Derived const &MatrixExpression<Derived>::derived() const {
+   return static_cast<Derived const &>(*this);
+}
+
+template <typename ElementType>
+MatrixTerminal<ElementType>::MatrixTerminal(MatrixView<ElementType const> view) : view(view) {}
+
+template <typename ElementType>
+bool MatrixTerminal<ElementType>::fits(size_t const height, size_t const width) const {
+   return view.height == height && view.width == width;
+}
+
+template <typename ElementType>
+ElementType const *MatrixTerminal<ElementType>::row(size_t const i) const {
+   return view[i];
+}
+
+template <typename ValueType>
+ValueType ScalarTerminal<ValueType>::Row::operator[](size_t) const {
+   return value;
+}
+
+template <typename ValueType>
+ScalarTerminal<ValueType>::ScalarTerminal(ValueType value) : value(value) {}
+
+template <typename ValueType>
+bool ScalarTerminal<ValueType>::fits(size_t, size_t) const {
+   return true;
+}
+
+template <typename ValueType>
+typename ScalarTerminal<ValueType>::Row ScalarTerminal<ValueType>::row(size_t) const {
+   return Row{value};
+}
+
+template <typename Operation, typename... Operands>
+template <typename... RowTypes>
+auto MatrixMap<Operation, Operands...>::Row<RowTypes...>::operator[](size_t const j) const {
+   return std::apply([&](auto const &... operand_rows) { return operation(operand_rows[j]...); }, rows);
+}
+
+template <typename Operation, typename... Operands>
+MatrixMap<Operation, Operands...>::MatrixMap(Operation operation, Operands... operands)
+      : operation(operation), operands(operands...) {}
+
+template <typename Operation, typename... Operands>
+bool MatrixMap<Operation, Operands...>::fits(size_t const height, size_t const width) const {
+   return std::apply([&](auto const &... operand) { return (operand.fits(height, width) && ...); }, operands);
+}
+
+template <typename Operation, typename... Operands>
+auto MatrixMap<Operation, Operands...>::row(size_t const i) const {
+   return std::apply(
+         [&](auto const &... operand) {
+            return Row<decltype(operand.row(i))...>{operation, std::make_tuple(operand.row(i)...)};
+         },
+         operands);
+}
+
+// Definitions - operands
+
+template <typename T>
+struct is_matrix_operand : std::is_base_of<MatrixExpression<T>, T> {};
+template <typename ElementType>
+struct is_matrix_operand<Matrix<ElementType>> : std::true_type {};
+template <typename ElementType>
+struct is_matrix_operand<MatrixView<ElementType>> : std::true_type {};
+
+template <typename Derived>
+Derived const &to_expression(MatrixExpression<Derived> const &expression) {
+   return expression.derived();
+}
+
+template <typename ElementType>
+MatrixTerminal<ElementType> to_expression(Matrix<ElementType> const &matrix) {
+   return MatrixTerminal<ElementType>(matrix.view());
+}
+
+template <typename ElementType>
+MatrixTerminal<std::remove_const_t<ElementType>> to_expression(MatrixView<ElementType> view) {
+   return MatrixTerminal<std::remove_const_t<ElementType>>(view);
+}
+
+template <typename ValueType, typename>
+ScalarTerminal<ValueType> to_expression(ValueType value) {
+   return ScalarTerminal<ValueType>(value);
+}
+
+template <typename ValueType>
+ScalarTerminal<ValueType> constant(ValueType value) {
+   return ScalarTerminal<ValueType>(value);
+}
+
+template <typename Function, typename... Operands>
+MatrixMap<Function, expression_type<Operands>...> elementwise(Function function, Operands const &... operands) {
+   return MatrixMap<Function, expression_type<Operands>...>(function, to_expression(operands)...);
+}
+
+#define MATRIX_EXPRESSION_OPERATOR(symbol, function_object)                                                          \
+   template <typename Left, typename Right>                                                                            \
+   enable_for_matrix_operands<MatrixMap<function_object, expression_type<Left>, expression_type<Right>>, Left, Right> \
+   operator symbol(Left const &left, Right const &right) {                                                             \
+      return elementwise(function_object(), left, right);                                                              \
+   }
+MATRIX_EXPRESSION_OPERATOR(+, std::plus<>)
+MATRIX_EXPRESSION_OPERATOR(-, std::minus<>)
+MATRIX_EXPRESSION_OPERATOR(*, std::multiplies<>)
+MATRIX_EXPRESSION_OPERATOR(/, std::divides<>)
+MATRIX_EXPRESSION_OPERATOR(<, std::less<>)
+MATRIX_EXPRESSION_OPERATOR(<=, std::less_equal<>)
+MATRIX_EXPRESSION_OPERATOR(>, std::greater<>)
+MATRIX_EXPRESSION_OPERATOR(>=, std::greater_equal<>)
+MATRIX_EXPRESSION_OPERATOR(==, std::equal_to<>)
+MATRIX_EXPRESSION_OPERATOR(!=, std::not_equal_to<>)
+MATRIX_EXPRESSION_OPERATOR(&&, std::logical_and<>)
+MATRIX_EXPRESSION_OPERATOR(||, std::logical_or<>)
+#undef MATRIX_EXPRESSION_OPERATOR
+
+template <typename Operand>
+enable_for_matrix_operands<MatrixMap<std::negate<>, expression_type<Operand>>, Operand> operator-(
+      Operand const &operand) {
+   return elementwise(std::negate<>(), operand);
+}
+
+template <typename ValueType, typename LowType, typename HighType>
+auto ClampOperation::operator()(ValueType const value, LowType const low, HighType const high) const {
+   using CommonType = std::common_type_t<ValueType, LowType, HighType>;
+   auto const v = static_cast<CommonType>(value), l = static_cast<CommonType>(low), h = static_cast<CommonType>(high);
+   return v < l ? l : (h < v ? h : v);
+}
+
+template <typename Operand, typename Low, typename High>
+enable_for_matrix_operands<MatrixMap<ClampOperation, expression_type<Operand>, expression_type<Low>,
+                                 expression_type<High>>,
+      Operand, Low, High>
+clamp(Operand const &operand, Low const &low, High const &high) {
+   return elementwise(ClampOperation(), operand, low, high);
+}
+
+template <typename ResultType>
+template <typename ValueType>
+ResultType CastOperation<ResultType>::operator()(ValueType const value) const {
+   return static_cast<ResultType>(value);
+}
+
+template <typename ResultType, typename Operand>
+enable_for_matrix_operands<MatrixMap<CastOperation<ResultType>, expression_type<Operand>>, Operand> cast(
+      Operand const &operand) {
+   return elementwise(CastOperation<ResultType>(), operand);
+}
+
+template <typename ConditionType, typename TrueType, typename FalseType>
+auto SelectOperation::operator()(
+      ConditionType const condition, TrueType const if_true, FalseType const if_false) const {
+   using CommonType = std::common_type_t<TrueType, FalseType>;
+   return condition ? static_cast<CommonType>(if_true) : static_cast<CommonType>(if_false);
+}
+
+template <typename Condition, typename IfTrue, typename IfFalse>
+enable_for_matrix_operands<MatrixMap<SelectOperation, expression_type<Condition>, expression_type<IfTrue>,
+                                 expression_type<IfFalse>>,
+      Condition, IfTrue, IfFalse>
+select(Condition const &condition, IfTrue const &if_true, IfFalse const &if_false) {
+   return elementwise(SelectOperation(), condition, if_true, if_false);
+}
+
+// Definitions - evaluation
+
+template <typename Expression, typename ElementType>
+void evaluate(MatrixExpression<Expression> const &expression, MatrixView<ElementType> destination,
+      Execution const execution) {
+   auto const &tree = expression.derived();
+   if (!tree.fits(destination.height, destination.width)) {
+      throw std::invalid_argument("The matrices of an expression have to be of the destination's size");
+   }
+   auto const evaluate_rows = [&](size_t const begin, size_t const end) {
+      for (size_t i = begin; i < end; ++i) {
+         auto const row = tree.row(i);
+         ElementType *const destination_row = destination[i];
+         for (size_t j = 0; j < destination.width; ++j) {
+            destination_row[j] = static_cast<ElementType>(row[j]);
+         }
+      }
+   };
+   if (execution == Execution::PARALLEL) {
+      parallel_for_rows(destination.height, evaluate_rows);
+   } else {
+      evaluate_rows(0, destination.height);
+   }
+}
+
+template <typename Expression, typename ElementType>
+void evaluate(MatrixExpression<Expression> const &expression, Matrix<ElementType> &destination,
+      Execution const execution) {
+   evaluate(expression, destination.view(), execution);
+}
+
+#endif
@@ -0,0 +1,223 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Declarations
+
+// Threads kept for the whole life of the program, which run the tasks of one batch at a time. Each thread starts
+// with its own share of the batch and, once it is done with it, steals tasks from the end of the other shares, so
+// tasks which take longer than others (e.g. rows with more valid pixels) don't leave the other threads idle.
+class ThreadPool {
+ public:
+   // The thread calling run() takes part too, so threads - 1 threads are started.
+   explicit ThreadPool(size_t threads = std::max(1u, std::thread::hardware_concurrency()));
+   ThreadPool(const ThreadPool &src) = delete;
+   ~ThreadPool();
+
+   // Calls task(i) for every i in [0, count) and returns once all calls have returned. Batches started from
+   // several threads run one after another; run() called from inside a task runs its batch on the calling thread.
+   // If a task throws, the remaining tasks still run and the first exception is rethrown.
+   void run(size_t count, std::function<void(size_t)> const &task);
+
+   size_t const threads;
+
+ private:
+   // The part of the current batch a thread started with. The owner takes tasks from the front, thieves from the back.
+   struct alignas(64) Share {
+      std::mutex mutex;
+      size_t next = 0, end = 0;
+   };
+
+   void worker(size_t index);
+   // Runs tasks from the thread's own share, then from the others', until there are none left.
+   void work(size_t index, std::function<void(size_t)> const &batch_task);
+   bool take(size_t share, bool from_front, size_t &task);
+
+   std::vector<std::thread> workers;
+   std::unique_ptr<Share[]> shares;
+
+   std::mutex batch_mutex;  // held for the whole run()
+   std::mutex mutex;
+   std::condition_variable batch_started, workers_left;
+   std::function<void(size_t)> const *task = nullptr;  // of the current batch, nullptr between batches
+   uint64_t batch = 0;
+   size_t working_workers = 0;
+   bool stopping = false;
+   std::exception_ptr exception;
+
+   static thread_local bool inside_task;
+};
+
+// The pool used by parallel_for_rows() unless given another one, started on first use with a thread per core.
+ThreadPool &default_thread_pool();
+// Replaces the default pool with one of the given size. Nothing may be using the default pool at the time.
+void set_default_thread_count(size_t threads);
+
+// Splits rows [0, height) into bands of at least min_band_height rows and calls function(begin, end) for each band
+// on the pool's threads. There are a few bands per thread so that the threads can even out the work by stealing.
+// function has to be safe to call concurrently for different bands.
+template <typename Function>
+void parallel_for_rows(size_t height, Function const &function, size_t min_band_height = 16,
+      ThreadPool &pool = default_thread_pool());
+
+// Definitions
+
+thread_local bool ThreadPool::inside_task = false;
+
+ThreadPool::ThreadPool(size_t const threads) : threads(std::max<size_t>(threads, 1)), shares(new Share[this->threads]) {
+   for (size_t i = 1; i < this->threads; ++i) {
+      workers.emplace_back(&ThreadPool::worker, this, i);
+   }
+}
+
+ThreadPool::~ThreadPool() {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   batch_started.notify_all();
+   for (auto &thread : workers) {
+      thread.join();
+   }
+}
+
+void ThreadPool::run(size_t const count, std::function<void(size_t)> const &batch_task) {
+   if (count == 0) {
+      return;
+   }
+   if (threads == 1 || count == 1 || inside_task) {
+      for (size_t i = 0; i < count; ++i) {
+         batch_task(i);
+      }
+      return;
+   }
+
+   std::lock_guard<std::mutex> batch_lock(batch_mutex);
+   for (size_t i = 0; i < threads; ++i) {
+      std::lock_guard<std::mutex> lock(shares[i].mutex);
+      shares[i].next = count * i / threads;
+      shares[i].end = count * (i + 1) / threads;
+   }
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = &batch_task;
+      ++batch;
+      exception = nullptr;
+   }
+   batch_started.notify_all();
+
+   work(0, batch_task);
+
+   std::unique_lock<std::mutex> lock(mutex);
+   // No worker can join the batch from now on. The ones which did may still be running their last tasks.
+   task = nullptr;
+   workers_left.wait(lock, [this] { return working_workers == 0; });
+   if (exception) {
+      std::rethrow_exception(exception);
+   }
+}
+
+void ThreadPool::worker(size_t const index) {
+   uint64_t last_batch = 0;
+   std::unique_lock<std::mutex> lock(mutex);
+   while (true) {
+      batch_started.wait(lock, [&] { return stopping || (task != nullptr && batch != last_batch); });
+      if (stopping) {
+         return;
+      }
+      last_batch = batch;
+      ++working_workers;
+      auto const &batch_task = *task;
+      lock.unlock();
+      work(index, batch_task);
+      lock.lock();
+      if (--working_workers == 0) {
+         workers_left.notify_one();
+      }
+   }
+}
+
+void ThreadPool::work(size_t const index, std::function<void(size_t)> const &batch_task) {
+   inside_task = true;
+   size_t next_task;
+   for (size_t k = 0; k < threads; ++k) {
+      size_t const share = (index + k) % threads;
+      while (take(share, k == 0, next_task)) {
+         try {
+            batch_task(next_task);
+         } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!exception) {
+               exception = std::current_exception();
+            }
+         }
+      }
+   }
+   inside_task = false;
+}
+
+bool ThreadPool::take(size_t const share, bool const from_front, size_t &next_task) {
+   std::lock_guard<std::mutex> lock(shares[share].mutex);
+   if (shares[share].next == shares[share].end) {
+      return false;
+   }
+   next_task = from_front ? shares[share].next++ : --shares[share].end;
+   return true;
+}
+
+std::unique_ptr<ThreadPool> &default_thread_pool_pointer() {
+   static std::unique_ptr<ThreadPool> pool(new ThreadPool());
+   return pool;
+}
+
+ThreadPool &default_thread_pool() {
+   return *default_thread_pool_pointer();
+}
+
+void set_default_thread_count(size_t const threads) {
+   default_thread_pool_pointer().reset(new ThreadPool(threads));
+}
+
+template <typename Function>
+void parallel_for_rows(
+      size_t const height, Function const &function, size_t const min_band_height, ThreadPool &pool) {
+   size_t const bands = std::min(height / std::max<size_t>(min_band_height, 1), 4 * pool.threads);
+   if (bands <= 1) {
+      if (height > 0) {
+         function(size_t(0), height);
+      }
+      return;
+   }
+   pool.run(bands, [&](size_t const band) { function(height * band / bands, height * (band + 1) / bands); });
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "basic_types.hpp"
+#include "depth_renderer.hpp"
+#include "parallel.hpp"
+#include "point_cloud.hpp"
+
+struct FrameSize {
+   size_t width, height;
+};
+
+const FrameSize frame_sizes[] = {{512, 424}, {1920, 1080}};
+
+// Runs the function repeatedly for about a second and returns the average time of one run in milliseconds.
+double time_per_run(std::function<void()> const &function) {
+   using clock = std::chrono::steady_clock;
+   function();  // warm-up
+   size_t runs = 0;
+   auto start = clock::now();
+   do {
+      function();
+      ++runs;
+   } while (clock::now() - start < std::chrono::seconds(1));
+   return std::chrono::duration<double, std::milli>(clock::now() - start).count() / runs;
+}
+
+void report(size_t threads, double milliseconds, double baseline) {
+   std::cout << "  " << threads << (threads == 1 ? " thread:  " : " threads: ") << milliseconds << " ms/frame ("
+             << baseline / milliseconds << "x)\n";
+}
+
+// Times the function with the default pool at 1 to max_threads threads.
+void measure(std::string const &name, size_t max_threads, std::function<void()> const &function) {
+   std::cout << name << ":\n";
+   double baseline = 0.0;
+   for (size_t threads = 1; threads <= max_threads; ++threads) {
+      set_default_thread_count(threads);
+      double const milliseconds = time_per_run(function);
+      if (threads == 1) {
+         baseline = milliseconds;
+      }
+      report(threads, milliseconds, baseline);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+   if (argc > 1) {
+      max_threads = std::max(1ul, std::strtoul(argv[1], nullptr, 10));
+   }
+   std::cout << "Measuring with 1 to " << max_threads << " threads (the maximum can be given as an argument)\n\n";
+
+   std::mt19937 generator(42);
+   std::normal_distribution<float> noise(0.0f, 3.0f);
+   DepthRenderer renderer;
+   renderer.set_range(500.0f, 4500.0f);
+
+   for (auto const &size : frame_sizes) {
+      // A tilted plane with a bump and some holes, like a person in front of a wall.
+      Matrix<float> depth(size.height, size.width);
+      for (size_t i = 0; i < size.height; ++i) {
+         for (size_t j = 0; j < size.width; ++j) {
+            float const bump = 400.0f * std::sin(3.0f * float(i) / float(size.height));
+            depth[i][j] = generator() % 50 == 0 ? 0.0f : 1500.0f + float(j) + bump + noise(generator);
+         }
+      }
+      std::vector<uint8_t> bitmap(3 * size.width * size.height);
+      // The intrinsics of the Kinect v2 IR camera, scaled to the frame's size.
+      float const scale = float(size.width) / 512.0f;
+      PointCloud point_cloud(size.width, size.height,
+            CameraIntrinsics{365.5f * scale, 365.5f * scale, float(size.width) / 2, float(size.height) / 2});
+      Matrix<float> reflectiveness(size.height, size.width);
+
+      std::string const frame = std::to_string(size.width) + "x" + std::to_string(size.height);
+      measure("Depth colorization, " + frame, max_threads,
+            [&] { renderer.render(depth, bitmap.data(), size.width); });
+      measure("Point cloud and surface reflectiveness, " + frame, max_threads, [&] {
+         point_cloud.compute(depth.data());
+         point_cloud.surface_reflectiveness(reflectiveness);
+      });
+      std::cout << "\n";
+   }
+
+   return 0;
+}
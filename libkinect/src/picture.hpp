@@ -24,34 +24,101 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <thread>
+#include <mutex>
+#include <type_traits>
 
+#include <fcntl.h>
 #include <libfreenect2/libfreenect2.hpp>
 #include <opencv/cv.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgcodecs.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zlib.h>
 
 #include "basic_types.hpp"
+#include "depth_codec.hpp"
+#include "pixel_conversion.hpp"
 
 // Declarations
 
+// OpenCV type of a matrix element, defined for the element types of the frames.
+template <typename ElementType>
+struct CvMatType;
+
+// Returns a cv::Mat using the matrix's memory, so that OpenCV functions can read and write it without copies. The
+// header doesn't keep the memory alive. A header of a const matrix or view must only be read from.
+template <typename ElementType>
+cv::Mat cv_mat_header(Matrix<ElementType> &matrix);
+template <typename ElementType>
+cv::Mat cv_mat_header(Matrix<ElementType> const &matrix);
+template <typename ElementType>
+cv::Mat cv_mat_header(MatrixView<ElementType> view);
+
+// Scales the source to the size of the destination, e.g. a part of a frame into a part of another one.
+template <typename SourceType, typename ElementType>
+void resize_into(MatrixView<SourceType> source, MatrixView<ElementType> destination);
+
+// How depth and IR frames are compressed when saved. Either way nothing is lost.
+enum class DepthCompression {
+   GZIP,  // the uncompressed file gzipped, saved as filename + ".gz"
+   CODEC  // depth_codec.hpp, saved as filename; depth_codec.hpp has how its size and speed compare with GZIP
+};
+
+// Calibration of a Kinect v2's cameras, as libfreenect2 reads it from the device.
+struct CameraParameters {
+   libfreenect2::Freenect2Device::IrCameraParams ir;
+   libfreenect2::Freenect2Device::ColorCameraParams color;
+};
+
+// Header of version 2 depth and IR files (see data_format.md). Version 1 files begin with the magic, the width and
+// the height; a width of 0 marks version 2. The pixels start at header_size, a multiple of 64 bytes, so that they are
+// as aligned in a mapped file as in a recording.
+struct DepthOrIrFileHeader {
+   char magic[4];  // "PHDE", "PHIR", "PHDU" or "PHIU", as in version 1
+   uint32_t version_marker;  // 0
+   uint32_t version;         // 2
+   uint32_t header_size;
+   uint32_t width;
+   uint32_t height;
+   uint32_t pixel_type;    // 1 - float, 2 - uint16_t, as in recordings
+   uint32_t codec;         // 0 - none, 1 - depth_codec.hpp
+   uint32_t samples;       // DepthCodecSamples of coded files
+   uint32_t which_kinect;  // 1 or 2, 0 if unknown
+   uint32_t timestamp;
+   uint32_t sequence;
+   int64_t time_received;  // nanoseconds since the epoch
+   uint64_t payload_size;  // bytes of pixels or coded data after the header
+   uint32_t flags;         // 1 - the camera parameters are set
+   uint32_t reserved;
+   float ir_camera[9];      // libfreenect2's IrCameraParams, in the order it declares them
+   float color_camera[26];  // libfreenect2's ColorCameraParams, likewise
+   uint8_t padding[44];
+};
+
+static_assert(sizeof(DepthOrIrFileHeader) == 256, "Depth and IR file headers must keep the pixels 64-byte aligned");
+static_assert(sizeof(CameraParameters::ir) == sizeof(DepthOrIrFileHeader::ir_camera), "Unexpected IrCameraParams");
+static_assert(sizeof(CameraParameters::color) == sizeof(DepthOrIrFileHeader::color_camera),
+      "Unexpected ColorCameraParams");
+
 class Picture {
  public:
    class ColorFrame;
    class DepthOrIrFrame;
 
    Picture() = default;
+   // Takes ownership of the frames.
    Picture(ColorFrame *color_frame, DepthOrIrFrame *depth_frame, DepthOrIrFrame *ir_frame);
-   Picture(const Picture &src);
-   ~Picture();
 
-   void save_all_to_files(std::string const &base_filename) const;
+   void save_all_to_files(std::string const &base_filename,
+         DepthCompression compression = DepthCompression::GZIP) const;
    void resize_all(size_t width, size_t height);
 
-   ColorFrame *color_frame = nullptr;
-   DepthOrIrFrame *depth_frame = nullptr;
-   DepthOrIrFrame *ir_frame = nullptr;
+   // Copies of a picture share its frames, use mutate() to get a frame which can be modified.
+   CowPtr<ColorFrame> color_frame;
+   CowPtr<DepthOrIrFrame> depth_frame;
+   CowPtr<DepthOrIrFrame> ir_frame;
 };
 
 class Picture::ColorFrame {
@@ -59,38 +126,156 @@ class Picture::ColorFrame {
    struct ColorPixel {
       uint8_t blue, green, red;
    };
+   static_assert(sizeof(ColorPixel) == 3, "ColorPixel must match OpenCV's CV_8UC3 layout");
 
    explicit ColorFrame(Matrix<ColorPixel> *pixels);
    explicit ColorFrame(std::string const &filename);
    ColorFrame(const ColorFrame &src);
+   ColorFrame(ColorFrame &&src) noexcept;
    ~ColorFrame();
 
+   ColorFrame &operator=(ColorFrame src) noexcept;
+
    void save_to_file(std::string const &filename) const;
+   // Saves only the width x height rectangle with its top left corner at (x, y), e.g. a face.
+   void save_crop_to_file(std::string const &filename, size_t y, size_t x, size_t height, size_t width) const;
    void resize(size_t width, size_t height);
+   // Writes the frame scaled to width x height as RGB into the top left corner of a bitmap bitmap_width pixels wide,
+   // leaving the frame as it is.
+   void resize_to_bitmap(uint8_t *bitmap, size_t bitmap_width, size_t width, size_t height) const;
 
    std::chrono::time_point<std::chrono::system_clock> time_received = std::chrono::system_clock::now();
+   // Set by the device: timestamp in device clock units, sequence counted per stream. 0 for frames read from files.
+   uint32_t timestamp = 0, sequence = 0;
 
    Matrix<ColorPixel> *pixels = nullptr;
 };
 
+template <>
+struct CvMatType<Picture::ColorFrame::ColorPixel> {
+   static int constexpr value = CV_8UC3;
+};
+
+template <>
+struct CvMatType<uint16_t> {
+   static int constexpr value = CV_16UC1;
+};
+
+template <>
+struct CvMatType<float> {
+   static int constexpr value = CV_32FC1;
+};
+
 class Picture::DepthOrIrFrame {
  public:
+   // Kinect v1 delivers 16-bit integers, libfreenect2 delivers floats. Frames keep whichever they were created with.
+   enum class PixelType { FLOAT, UINT16 };
+
    DepthOrIrFrame(Matrix<float> *pixels, bool is_depth);
+   DepthOrIrFrame(Matrix<uint16_t> *pixels, bool is_depth);
+   // Reads a file saved by save_to_file() with any compression, or uncompressed.
    explicit DepthOrIrFrame(std::string const &filename);
    DepthOrIrFrame(const DepthOrIrFrame &src);
+   DepthOrIrFrame(DepthOrIrFrame &&src) noexcept;
    ~DepthOrIrFrame();
 
-   void save_to_file(std::string const &filename) const;
+   DepthOrIrFrame &operator=(DepthOrIrFrame src) noexcept;
+
+   void save_to_file(std::string const &filename, DepthCompression compression = DepthCompression::GZIP) const;
+   // Saves only the width x height rectangle with its top left corner at (x, y), e.g. a face.
+   void save_crop_to_file(std::string const &filename, size_t y, size_t x, size_t height, size_t width,
+         DepthCompression compression = DepthCompression::GZIP) const;
+   // Also drops camera_parameters and freenect2_frame, which no longer describe the pixels.
    void resize(size_t width, size_t height);
 
-   Matrix<float> *pixels = nullptr;
+   size_t width() const;
+   size_t height() const;
+   PixelType pixel_type() const;
+   // Calls function with the frame's own pixels, either a Matrix<float> & or a Matrix<uint16_t> &. The float copy of
+   // a UINT16 frame is dropped first, as the function may change the pixels.
+   template <typename Function>
+   auto visit_pixels(Function function);
+   template <typename Function>
+   auto visit_pixels(Function function) const;
+   // Pixels as floats. UINT16 frames are converted on first use and the result is kept until the pixels are visited
+   // for a change or the frame is resized.
+   Matrix<float> const &float_pixels() const;
+
    bool is_depth;  // false means that it's an IR photo
 
    std::chrono::time_point<std::chrono::system_clock> time_received = std::chrono::system_clock::now();
+   // Set by the device: timestamp in device clock units, sequence counted per stream. Files of version 2 keep them, 0
+   // for frames read from other files.
+   uint32_t timestamp = 0, sequence = 0;
+   // Set by the device too, and kept in files: 1 or 2 for frames of that Kinect version, 0 if unknown.
+   int which_kinect = 0;
+   // Shared by the frames of a Kinect v2. nullptr if unknown, e.g. for Kinect v1 or version 1 files.
+   std::shared_ptr<CameraParameters const> camera_parameters = nullptr;
 
    std::shared_ptr<libfreenect2::Frame> freenect2_frame = nullptr;
+
+ private:
+   // Where a file keeps its pixels, from its header.
+   struct FileLayout {
+      size_t width, height;
+      PixelType pixel_type;
+      size_t payload_offset;
+      bool coded;
+      DepthCodecSamples samples;  // of coded files
+      uint64_t payload_size;      // of coded files
+   };
+
+   static std::string magic(bool is_depth, PixelType pixel_type);
+   // Bytes of header needed by read_header() for a file beginning with these 12 bytes.
+   static size_t header_size(char const *beginning);
+   // Sets is_depth and, from version 2 files, the device's fields.
+   FileLayout read_header(char const *header, std::string const &filename);
+   // The camera parameters of a crop have the IR principal point moved by the crop's offset.
+   DepthOrIrFileHeader version2_header(size_t y, size_t x, size_t height, size_t width, bool coded,
+         DepthCodecSamples samples, uint64_t payload_size) const;
+   // Decompresses a gzipped file into the frame's own matrix.
+   void load_gzip(std::string const &filename);
+   // Maps an uncompressed file into memory, the matrix borrows the mapping. Files coded with the depth codec are
+   // decoded from the mapping into the frame's own matrix instead.
+   void load_mapped(std::string const &filename);
+   void save_crop_gzip(std::string const &filename, size_t y, size_t x, size_t height, size_t width) const;
+   void save_crop_coded(std::string const &filename, size_t y, size_t x, size_t height, size_t width) const;
+   // Of a UINT16 frame, whose pixels are about to change.
+   void drop_float_copy();
+
+   Matrix<float> *pixels = nullptr;  // FLOAT frames, or the float copy of a UINT16 frame
+   Matrix<uint16_t> *uint16_pixels = nullptr;
+   mutable std::mutex float_conversion_mutex;
 };
 
+// Definitions - cv::Mat headers
+
+template <typename ElementType>
+cv::Mat cv_mat_header(Matrix<ElementType> &matrix) {
+   return cv_mat_header(matrix.view());
+}
+
+template <typename ElementType>
+cv::Mat cv_mat_header(Matrix<ElementType> const &matrix) {
+   return cv_mat_header(matrix.view());
+}
+
+template <typename ElementType>
+cv::Mat cv_mat_header(MatrixView<ElementType> const view) {
+   using Element = std::remove_const_t<ElementType>;
+   return cv::Mat(static_cast<int>(view.height), static_cast<int>(view.width), CvMatType<Element>::value,
+         const_cast<Element *>(view.memory), view.stride * sizeof(Element));
+}
+
+template <typename SourceType, typename ElementType>
+void resize_into(MatrixView<SourceType> const source, MatrixView<ElementType> const destination) {
+   static_assert(std::is_same<std::remove_const_t<SourceType>, ElementType>::value,
+         "resize_into() needs views of the same element type");
+   // A destination header of the right size and type is written to in place, never reallocated.
+   cv::Mat destination_image = cv_mat_header(destination);
+   cv::resize(cv_mat_header(source), destination_image, destination_image.size());
+}
+
 // Definitions - ColorFrame
 
 Picture::ColorFrame::ColorFrame(Matrix<ColorPixel> *pixels) : pixels(pixels) {}
@@ -108,110 +293,424 @@ Picture::ColorFrame::ColorFrame(std::string const &filename) {
 }
 
 Picture::ColorFrame::ColorFrame(const Picture::ColorFrame &src)
-      : pixels(new Matrix<Picture::ColorFrame::ColorPixel>(*src.pixels)), time_received(src.time_received) {}
+      : time_received(src.time_received), timestamp(src.timestamp), sequence(src.sequence),
+        pixels(new Matrix<Picture::ColorFrame::ColorPixel>(*src.pixels)) {}
+
+Picture::ColorFrame::ColorFrame(Picture::ColorFrame &&src) noexcept
+      : time_received(src.time_received), timestamp(src.timestamp), sequence(src.sequence), pixels(src.pixels) {
+   src.pixels = nullptr;
+}
 
 Picture::ColorFrame::~ColorFrame() {
    delete pixels;
 }
 
+Picture::ColorFrame &Picture::ColorFrame::operator=(Picture::ColorFrame src) noexcept {
+   std::swap(time_received, src.time_received);
+   std::swap(timestamp, src.timestamp);
+   std::swap(sequence, src.sequence);
+   std::swap(pixels, src.pixels);
+   return *this;
+}
+
 void Picture::ColorFrame::save_to_file(std::string const &filename) const {
-   auto *pixels_copy = new Matrix<ColorPixel>(*pixels);
-   std::thread t([filename, pixels_copy] {
-      cv::Mat image(cv::Size(static_cast<int>(pixels_copy->width), static_cast<int>(pixels_copy->height)), CV_8UC3,
-            (uint8_t *)(pixels_copy->data()));
-      cv::imwrite(filename, image);
-      delete pixels_copy;
-   });
-   t.detach();
+   save_crop_to_file(filename, 0, 0, pixels->height, pixels->width);
+}
+
+void Picture::ColorFrame::save_crop_to_file(
+      std::string const &filename, size_t const y, size_t const x, size_t const height, size_t const width) const {
+   if (!cv::imwrite(filename, cv_mat_header(pixels->view(y, x, height, width)))) {
+      throw std::runtime_error("cv::imwrite() could not write file " + filename);
+   }
 }
 
 void Picture::ColorFrame::resize(size_t const width, size_t const height) {
-   cv::Mat current_image(cv::Size(static_cast<int>(pixels->width), static_cast<int>(pixels->height)), CV_8UC3,
-         (uint8_t *)(pixels->data()));
-   cv::Mat destination_image(cv::Size(static_cast<int>(width), static_cast<int>(height)), CV_8UC3);
-   cv::resize(current_image, destination_image, destination_image.size());
+   auto resized = new Matrix<ColorPixel>(height, width);
+   resize_into(pixels->view(), resized->view());
    delete pixels;
-   pixels = new Matrix<ColorPixel>(height, width);
-   for (size_t i = 0; i < height; ++i) {
-      for (size_t j = 0; j < width; ++j) {
-         auto pixel = destination_image.at<cv::Vec3b>(static_cast<int>(i), static_cast<int>(j));
-         (*pixels)[i][j] = ColorPixel{pixel[0], pixel[1], pixel[2]};
-      }
+   pixels = resized;
+}
+
+void Picture::ColorFrame::resize_to_bitmap(
+      uint8_t *const bitmap, size_t const bitmap_width, size_t const width, size_t const height) const {
+   cv::Mat destination_image(
+         static_cast<int>(height), static_cast<int>(width), CV_8UC3, bitmap, 3 * bitmap_width);
+   if (width == pixels->width && height == pixels->height) {
+      cv::cvtColor(cv_mat_header(*pixels), destination_image, cv::COLOR_BGR2RGB);
+      return;
    }
+   cv::resize(cv_mat_header(*pixels), destination_image, destination_image.size());
+   cv::cvtColor(destination_image, destination_image, cv::COLOR_BGR2RGB);
 }
 
 // Definitions - DepthOrIrFrame
 
+template <typename Function>
+auto Picture::DepthOrIrFrame::visit_pixels(Function function) {
+   if (uint16_pixels != nullptr) {
+      drop_float_copy();
+      return function(*uint16_pixels);
+   }
+   return function(*pixels);
+}
+
+template <typename Function>
+auto Picture::DepthOrIrFrame::visit_pixels(Function function) const {
+   if (uint16_pixels != nullptr) {
+      return function(static_cast<Matrix<uint16_t> const &>(*uint16_pixels));
+   }
+   return function(static_cast<Matrix<float> const &>(*pixels));
+}
+
 Picture::DepthOrIrFrame::DepthOrIrFrame(Matrix<float> *pixels, bool const is_depth)
-      : pixels(pixels), is_depth(is_depth) {}
+      : is_depth(is_depth), pixels(pixels) {}
+
+Picture::DepthOrIrFrame::DepthOrIrFrame(Matrix<uint16_t> *pixels, bool const is_depth)
+      : is_depth(is_depth), uint16_pixels(pixels) {}
 
 Picture::DepthOrIrFrame::DepthOrIrFrame(std::string const &filename) {
+   unsigned char signature[2] = {0, 0};
    std::ifstream file_stream(filename, std::ifstream::binary);
-   if (file_stream) {
-      char header[12];
-      file_stream.read(header, 12);
-      std::string magic(header, 4);
-      if (magic == "PHDE") {
-         is_depth = true;
-      } else if (magic == "PHIR") {
-         is_depth = false;
+   if (!file_stream || !file_stream.read(reinterpret_cast<char *>(signature), 2)) {
+      throw std::runtime_error("Error reading file " + filename);
+   }
+   file_stream.close();
+   try {
+      if (signature[0] == 0x1f && signature[1] == 0x8b) {
+         load_gzip(filename);
       } else {
-         throw std::invalid_argument("Invalid magic in file " + filename);
+         load_mapped(filename);
       }
-      size_t width = reinterpret_cast<uint32_t *>(header)[1], height = reinterpret_cast<uint32_t *>(header)[2];
-      pixels = new Matrix<float>(height, width);
-      file_stream.read(reinterpret_cast<char *>(pixels->data()), height * width * sizeof(float));
-   } else {
-      throw std::runtime_error("Error reading file " + filename);
+   } catch (...) {
+      delete pixels;
+      delete uint16_pixels;
+      throw;
    }
 }
 
 Picture::DepthOrIrFrame::DepthOrIrFrame(const Picture::DepthOrIrFrame &src)
-      : pixels(new Matrix<float>(*src.pixels)), is_depth(src.is_depth), freenect2_frame(src.freenect2_frame),
-        time_received(src.time_received) {}
+      : is_depth(src.is_depth), time_received(src.time_received), timestamp(src.timestamp), sequence(src.sequence),
+        which_kinect(src.which_kinect), camera_parameters(src.camera_parameters),
+        freenect2_frame(src.freenect2_frame) {
+   if (src.uint16_pixels != nullptr) {
+      uint16_pixels = new Matrix<uint16_t>(*src.uint16_pixels);
+   } else {
+      pixels = new Matrix<float>(*src.pixels);
+   }
+}
+
+Picture::DepthOrIrFrame::DepthOrIrFrame(Picture::DepthOrIrFrame &&src) noexcept
+      : is_depth(src.is_depth), time_received(src.time_received), timestamp(src.timestamp), sequence(src.sequence),
+        which_kinect(src.which_kinect), camera_parameters(std::move(src.camera_parameters)),
+        freenect2_frame(std::move(src.freenect2_frame)), pixels(src.pixels), uint16_pixels(src.uint16_pixels) {
+   src.pixels = nullptr;
+   src.uint16_pixels = nullptr;
+}
 
 Picture::DepthOrIrFrame::~DepthOrIrFrame() {
    delete pixels;
+   delete uint16_pixels;
+}
+
+Picture::DepthOrIrFrame &Picture::DepthOrIrFrame::operator=(Picture::DepthOrIrFrame src) noexcept {
+   std::swap(is_depth, src.is_depth);
+   std::swap(time_received, src.time_received);
+   std::swap(timestamp, src.timestamp);
+   std::swap(sequence, src.sequence);
+   std::swap(which_kinect, src.which_kinect);
+   std::swap(camera_parameters, src.camera_parameters);
+   std::swap(freenect2_frame, src.freenect2_frame);
+   std::swap(pixels, src.pixels);
+   std::swap(uint16_pixels, src.uint16_pixels);
+   return *this;
 }
 
-void Picture::DepthOrIrFrame::save_to_file(std::string const &filename) const {
-   size_t pixels_size = pixels->height * pixels->width * sizeof(float);
-   auto file_data = new char[12 + pixels_size];
-   if (is_depth) {
-      memcpy(file_data, "PHDE", 4);
+std::string Picture::DepthOrIrFrame::magic(bool const is_depth, PixelType const pixel_type) {
+   if (pixel_type == PixelType::UINT16) {
+      return is_depth ? "PHDU" : "PHIU";
+   }
+   return is_depth ? "PHDE" : "PHIR";
+}
+
+size_t Picture::DepthOrIrFrame::header_size(char const *const beginning) {
+   return reinterpret_cast<uint32_t const *>(beginning)[1] == 0 ? sizeof(DepthOrIrFileHeader) : 12;
+}
+
+Picture::DepthOrIrFrame::FileLayout Picture::DepthOrIrFrame::read_header(
+      char const *const header, std::string const &filename) {
+   std::string magic(header, 4);
+   if (magic == "PHDE" || magic == "PHDU") {
+      is_depth = true;
+   } else if (magic == "PHIR" || magic == "PHIU") {
+      is_depth = false;
    } else {
-      memcpy(file_data, "PHIR", 4);
+      throw std::invalid_argument("Invalid magic in file " + filename);
+   }
+   auto const fields = reinterpret_cast<uint32_t const *>(header);
+   FileLayout layout{fields[1], fields[2], magic[3] == 'U' ? PixelType::UINT16 : PixelType::FLOAT, 12, false,
+         DepthCodecSamples::UINT16, 0};
+   if (layout.width != 0) {
+      return layout;
    }
-   reinterpret_cast<uint32_t *>(file_data)[1] = static_cast<uint32_t>(pixels->width);
-   reinterpret_cast<uint32_t *>(file_data)[2] = static_cast<uint32_t>(pixels->height);
-   memcpy(file_data + 12, reinterpret_cast<char *>(pixels->data()), pixels_size);
+
+   DepthOrIrFileHeader file_header;
+   memcpy(&file_header, header, sizeof(file_header));
+   if (file_header.version != 2) {
+      throw std::invalid_argument(
+            "Unsupported version " + std::to_string(file_header.version) + " of file " + filename);
+   }
+   if (file_header.header_size < sizeof(file_header) || file_header.header_size % 64 != 0
+         || file_header.pixel_type != (magic[3] == 'U' ? 2u : 1u) || file_header.codec > 1) {
+      throw std::invalid_argument("Invalid header in file " + filename);
+   }
+   layout.width = file_header.width;
+   layout.height = file_header.height;
+   layout.payload_offset = file_header.header_size;
+   layout.coded = file_header.codec == 1;
+   layout.samples = static_cast<DepthCodecSamples>(file_header.samples);
+   layout.payload_size = file_header.payload_size;
+
+   which_kinect = static_cast<int>(file_header.which_kinect);
+   timestamp = file_header.timestamp;
+   sequence = file_header.sequence;
+   time_received = std::chrono::time_point<std::chrono::system_clock>(
+         std::chrono::duration_cast<std::chrono::system_clock::duration>(
+               std::chrono::nanoseconds(file_header.time_received)));
+   if (file_header.flags & 1) {
+      auto parameters = std::make_shared<CameraParameters>();
+      memcpy(&parameters->ir, file_header.ir_camera, sizeof(parameters->ir));
+      memcpy(&parameters->color, file_header.color_camera, sizeof(parameters->color));
+      camera_parameters = std::move(parameters);
+   }
+   return layout;
+}
+
+DepthOrIrFileHeader Picture::DepthOrIrFrame::version2_header(size_t const y, size_t const x, size_t const height,
+      size_t const width, bool const coded, DepthCodecSamples const samples, uint64_t const payload_size) const {
+   DepthOrIrFileHeader header{};
+   memcpy(header.magic, magic(is_depth, pixel_type()).data(), 4);
+   header.version = 2;
+   header.header_size = sizeof(header);
+   header.width = static_cast<uint32_t>(width);
+   header.height = static_cast<uint32_t>(height);
+   header.pixel_type = pixel_type() == PixelType::UINT16 ? 2 : 1;
+   header.codec = coded ? 1 : 0;
+   header.samples = coded ? static_cast<uint32_t>(samples) : 0;
+   header.which_kinect = static_cast<uint32_t>(which_kinect);
+   header.timestamp = timestamp;
+   header.sequence = sequence;
+   header.time_received =
+         std::chrono::duration_cast<std::chrono::nanoseconds>(time_received.time_since_epoch()).count();
+   header.payload_size = payload_size;
+   if (camera_parameters) {
+      // The color camera's parameters map IR pixels relative to the IR principal point, so they stay as they are.
+      auto ir = camera_parameters->ir;
+      ir.cx -= static_cast<float>(x);
+      ir.cy -= static_cast<float>(y);
+      header.flags = 1;
+      memcpy(header.ir_camera, &ir, sizeof(header.ir_camera));
+      memcpy(header.color_camera, &camera_parameters->color, sizeof(header.color_camera));
+   }
+   return header;
+}
+
+void Picture::DepthOrIrFrame::load_gzip(std::string const &filename) {
+   std::unique_ptr<std::remove_pointer<gzFile>::type, int (*)(gzFile)> gz_file(
+         gzopen(filename.c_str(), "rb"), gzclose);
+   if (gz_file == nullptr) {
+      throw std::runtime_error("gzopen() could not open file " + filename);
+   }
+   gzbuffer(gz_file.get(), 1 << 17);
+   // The first 12 bytes tell how much more of the header there is.
+   DepthOrIrFileHeader header;
+   char *const header_bytes = reinterpret_cast<char *>(&header);
+   if (gzread(gz_file.get(), header_bytes, 12) != 12) {
+      throw std::runtime_error("File " + filename + " is truncated");
+   }
+   auto const rest = static_cast<unsigned int>(header_size(header_bytes) - 12);
+   if (gzread(gz_file.get(), header_bytes + 12, rest) != int(rest)) {
+      throw std::runtime_error("File " + filename + " is truncated");
+   }
+   auto const layout = read_header(header_bytes, filename);
+   if (layout.coded) {
+      throw std::invalid_argument("File " + filename + " is coded with the depth codec, which is never gzipped");
+   }
+   if (gzseek(gz_file.get(), static_cast<z_off_t>(layout.payload_offset), SEEK_SET) < 0) {
+      throw std::runtime_error("File " + filename + " is truncated");
+   }
+   if (layout.pixel_type == PixelType::UINT16) {
+      uint16_pixels = new Matrix<uint16_t>(layout.height, layout.width);
+   } else {
+      pixels = new Matrix<float>(layout.height, layout.width);
+   }
+   // Decompressed straight into the matrix.
+   visit_pixels([&](auto &matrix) {
+      auto const size = static_cast<unsigned int>(layout.height * layout.width * sizeof(*matrix.data()));
+      if (gzread(gz_file.get(), matrix.data(), size) != int(size)) {
+         throw std::runtime_error("File " + filename + " is truncated");
+      }
+   });
+}
+
+void Picture::DepthOrIrFrame::load_mapped(std::string const &filename) {
+   int descriptor = open(filename.c_str(), O_RDONLY);
+   if (descriptor < 0) {
+      throw std::runtime_error("Error reading file " + filename);
+   }
+   struct stat file_status {};
+   if (fstat(descriptor, &file_status) != 0 || file_status.st_size < 12) {
+      ::close(descriptor);
+      throw std::runtime_error("File " + filename + " is truncated");
+   }
+   auto const file_size = static_cast<size_t>(file_status.st_size);
+   // A private writable mapping, so that modifying the pixels in place never touches the file.
+   void *mapping = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+   ::close(descriptor);
+   if (mapping == MAP_FAILED) {
+      throw std::runtime_error("mmap() failed for file " + filename);
+   }
+   std::shared_ptr<void> owner(mapping, [file_size](void *memory) { munmap(memory, file_size); });
+   madvise(mapping, file_size, MADV_WILLNEED);
+
+   auto const file = static_cast<char *>(mapping);
+   if (file_size < header_size(file)) {
+      throw std::runtime_error("File " + filename + " is truncated");
+   }
+   auto const layout = read_header(file, filename);
+   size_t const height = layout.height, width = layout.width;
+   if (layout.coded) {
+      if (layout.payload_offset > file_size || layout.payload_size > file_size - layout.payload_offset) {
+         throw std::runtime_error("File " + filename + " is truncated");
+      }
+      auto const data = reinterpret_cast<uint8_t const *>(file + layout.payload_offset);
+      if (layout.pixel_type == PixelType::UINT16) {
+         uint16_pixels = new Matrix<uint16_t>(height, width);
+         depth_codec_decode(data, layout.payload_size, layout.samples, uint16_pixels->view());
+      } else {
+         pixels = new Matrix<float>(height, width);
+         depth_codec_decode(data, layout.payload_size, layout.samples, pixels->view());
+      }
+      return;
+   }
+   size_t const element_size = layout.pixel_type == PixelType::UINT16 ? sizeof(uint16_t) : sizeof(float);
+   if (file_size < layout.payload_offset + height * width * element_size) {
+      throw std::runtime_error("File " + filename + " is truncated");
+   }
+   char *data = file + layout.payload_offset;
+   if (layout.pixel_type == PixelType::UINT16) {
+      uint16_pixels = new Matrix<uint16_t>(height, width, reinterpret_cast<uint16_t *>(data), owner);
+   } else {
+      pixels = new Matrix<float>(height, width, reinterpret_cast<float *>(data), owner);
+   }
+}
+
+size_t Picture::DepthOrIrFrame::width() const {
+   return visit_pixels([](auto const &matrix) { return matrix.width; });
+}
+
+size_t Picture::DepthOrIrFrame::height() const {
+   return visit_pixels([](auto const &matrix) { return matrix.height; });
+}
+
+Picture::DepthOrIrFrame::PixelType Picture::DepthOrIrFrame::pixel_type() const {
+   return uint16_pixels != nullptr ? PixelType::UINT16 : PixelType::FLOAT;
+}
+
+Matrix<float> const &Picture::DepthOrIrFrame::float_pixels() const {
+   if (uint16_pixels != nullptr) {
+      std::lock_guard<std::mutex> lock(float_conversion_mutex);
+      if (pixels == nullptr) {
+         auto converted = new Matrix<float>(uint16_pixels->height, uint16_pixels->width);
+         convert_uint16_to_float(uint16_pixels->data(), converted->data(), converted->height * converted->width);
+         const_cast<DepthOrIrFrame *>(this)->pixels = converted;
+      }
+   }
+   return *pixels;
+}
+
+void Picture::DepthOrIrFrame::drop_float_copy() {
+   std::lock_guard<std::mutex> lock(float_conversion_mutex);
+   delete pixels;
+   pixels = nullptr;
+}
+
+void Picture::DepthOrIrFrame::save_to_file(std::string const &filename, DepthCompression const compression) const {
+   save_crop_to_file(filename, 0, 0, height(), width(), compression);
+}
+
+void Picture::DepthOrIrFrame::save_crop_to_file(std::string const &filename, size_t const y, size_t const x,
+      size_t const height, size_t const width, DepthCompression const compression) const {
+   // Checks the rectangle before the file is created.
+   visit_pixels([&](auto const &matrix) { matrix.view(y, x, height, width); });
+   if (compression == DepthCompression::CODEC) {
+      save_crop_coded(filename, y, x, height, width);
+   } else {
+      save_crop_gzip(filename, y, x, height, width);
+   }
+}
+
+void Picture::DepthOrIrFrame::save_crop_gzip(
+      std::string const &filename, size_t const y, size_t const x, size_t const height, size_t const width) const {
+   size_t const element_size = pixel_type() == PixelType::UINT16 ? sizeof(uint16_t) : sizeof(float);
+   auto const header =
+         version2_header(y, x, height, width, false, DepthCodecSamples::UINT16, height * width * element_size);
 
    gzFile gz_file = gzopen((filename + ".gz").c_str(), "w");
    if (gz_file == Z_NULL) {
       throw std::runtime_error("gzopen() could not open file " + filename + ".gz");
    }
-   if (gzwrite(gz_file, file_data, static_cast<unsigned int>(12 + pixels_size)) != 12 + pixels_size) {
+   // The header and the pixels are compressed straight from where they are, without a staging copy. A crop narrower
+   // than the frame is written row by row.
+   bool written = gzwrite(gz_file, &header, sizeof(header)) == sizeof(header);
+   visit_pixels([&](auto const &matrix) {
+      auto const view = matrix.view(y, x, height, width);
+      size_t const rows = view.contiguous() ? 1 : height;
+      auto const bytes = static_cast<unsigned int>((view.contiguous() ? height : 1) * width * sizeof(*view.memory));
+      for (size_t i = 0; i < rows && written; ++i) {
+         written = gzwrite(gz_file, view[i], bytes) == static_cast<int>(bytes);
+      }
+   });
+   if (!written) {
+      gzclose(gz_file);
       throw std::runtime_error("gzwrite() did not correctly write to file " + filename + ".gz");
    }
    if (gzclose(gz_file) != Z_OK) {
       throw std::runtime_error("gzclose() did not correctly close file " + filename + ".gz");
    }
-   delete[] file_data;
+}
+
+void Picture::DepthOrIrFrame::save_crop_coded(
+      std::string const &filename, size_t const y, size_t const x, size_t const height, size_t const width) const {
+   auto const encoded = visit_pixels([&](auto const &matrix) {
+      return depth_codec_encode(matrix.view(y, x, height, width));
+   });
+   auto const header = version2_header(y, x, height, width, true, encoded.samples, encoded.bytes.size());
+
+   std::ofstream file(filename, std::ofstream::binary);
+   file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+   file.write(reinterpret_cast<char const *>(encoded.bytes.data()), static_cast<std::streamsize>(header.payload_size));
+   file.close();
+   if (!file) {
+      throw std::runtime_error("Could not write file " + filename);
+   }
 }
 
 void Picture::DepthOrIrFrame::resize(size_t width, size_t height) {
-   cv::Mat current_image(cv::Size(static_cast<int>(pixels->width), static_cast<int>(pixels->height)), CV_32FC1,
-         (uint8_t *)(pixels->data()));
-   cv::Mat destination_image(cv::Size(static_cast<int>(width), static_cast<int>(height)), CV_32FC1);
-   cv::resize(current_image, destination_image, destination_image.size());
-   delete pixels;
-   pixels = new Matrix<float>(height, width);
-   for (size_t i = 0; i < height; ++i) {
-      for (size_t j = 0; j < width; ++j) {
-         auto pixel = destination_image.at<float>(static_cast<int>(i), static_cast<int>(j));
-         (*pixels)[i][j] = pixel;
-      }
+   // Neither the camera's parameters nor libfreenect2's frame describe the resized pixels.
+   camera_parameters = nullptr;
+   freenect2_frame = nullptr;
+   if (uint16_pixels != nullptr) {
+      auto resized = new Matrix<uint16_t>(height, width);
+      resize_into(uint16_pixels->view(), resized->view());
+      delete uint16_pixels;
+      uint16_pixels = resized;
+      drop_float_copy();
+      return;
    }
+   auto resized = new Matrix<float>(height, width);
+   resize_into(pixels->view(), resized->view());
+   delete pixels;
+   pixels = resized;
 }
 
 // Definitions - Picture
@@ -219,45 +718,27 @@ void Picture::DepthOrIrFrame::resize(size_t width, size_t height) {
 Picture::Picture(ColorFrame *color_frame, DepthOrIrFrame *depth_frame, DepthOrIrFrame *ir_frame)
       : color_frame(color_frame), depth_frame(depth_frame), ir_frame(ir_frame) {}
 
-Picture::Picture(const Picture &src) {
-   if (src.color_frame != nullptr) {
-      color_frame = new ColorFrame(new Matrix<Picture::ColorFrame::ColorPixel>(*src.color_frame->pixels));
-   }
-   if (src.depth_frame != nullptr) {
-      depth_frame = new DepthOrIrFrame(new Matrix<float>(*src.depth_frame->pixels), true);
-   }
-   if (src.ir_frame != nullptr) {
-      ir_frame = new DepthOrIrFrame(new Matrix<float>(*src.ir_frame->pixels), false);
-   }
-}
-
-Picture::~Picture() {
-   delete color_frame;
-   delete depth_frame;
-   delete ir_frame;
-}
-
-void Picture::save_all_to_files(std::string const &base_filename) const {
-   if (color_frame != nullptr) {
+void Picture::save_all_to_files(std::string const &base_filename, DepthCompression const compression) const {
+   if (color_frame) {
       color_frame->save_to_file(base_filename + ".png");
    }
-   if (depth_frame != nullptr) {
-      depth_frame->save_to_file(base_filename + ".depth");
+   if (depth_frame) {
+      depth_frame->save_to_file(base_filename + ".depth", compression);
    }
-   if (ir_frame != nullptr) {
-      ir_frame->save_to_file(base_filename + ".ir");
+   if (ir_frame) {
+      ir_frame->save_to_file(base_filename + ".ir", compression);
    }
 }
 
 void Picture::resize_all(size_t width, size_t height) {
-   if (color_frame != nullptr) {
-      color_frame->resize(width, height);
+   if (color_frame) {
+      color_frame.mutate()->resize(width, height);
    }
-   if (depth_frame != nullptr) {
-      depth_frame->resize(width, height);
+   if (depth_frame) {
+      depth_frame.mutate()->resize(width, height);
    }
-   if (ir_frame != nullptr) {
-      ir_frame->resize(width, height);
+   if (ir_frame) {
+      ir_frame.mutate()->resize(width, height);
    }
 }
 
@@ -0,0 +1,176 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PIXEL_CONVERSION_HPP
+#define PIXEL_CONVERSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PIXEL_CONVERSION_X86
+#include <immintrin.h>
+#endif
+
+// Declarations
+
+// Conversions between the pixel formats delivered by the Kinects and the ones used by Picture. Each conversion has
+// a scalar version and, on x86, SIMD versions; the plain functions pick the best one for the CPU on first use.
+
+// 4-byte BGRX pixels (Kinect v2 color) to packed 3-byte BGR pixels.
+void convert_bgrx_to_bgr(uint8_t const *source, uint8_t *destination, size_t pixel_count);
+// 16-bit depth or IR values (Kinect v1) to floats.
+void convert_uint16_to_float(uint16_t const *source, float *destination, size_t count);
+
+void convert_bgrx_to_bgr_scalar(uint8_t const *source, uint8_t *destination, size_t pixel_count);
+void convert_uint16_to_float_scalar(uint16_t const *source, float *destination, size_t count);
+#ifdef PIXEL_CONVERSION_X86
+void convert_bgrx_to_bgr_ssse3(uint8_t const *source, uint8_t *destination, size_t pixel_count);
+void convert_uint16_to_float_sse2(uint16_t const *source, float *destination, size_t count);
+void convert_uint16_to_float_avx2(uint16_t const *source, float *destination, size_t count);
+#endif
+
+bool cpu_supports_ssse3();
+bool cpu_supports_avx2();
+// Names of the instruction sets used by the dispatching functions, for logging and benchmarks.
+char const *bgrx_to_bgr_implementation();
+char const *uint16_to_float_implementation();
+
+// Definitions - scalar
+
+void convert_bgrx_to_bgr_scalar(uint8_t const *source, uint8_t *destination, size_t const pixel_count) {
+   for (size_t i = 0; i < pixel_count; ++i) {
+      destination[3 * i] = source[4 * i];
+      destination[3 * i + 1] = source[4 * i + 1];
+      destination[3 * i + 2] = source[4 * i + 2];
+   }
+}
+
+void convert_uint16_to_float_scalar(uint16_t const *source, float *destination, size_t const count) {
+   for (size_t i = 0; i < count; ++i) {
+      destination[i] = static_cast<float>(source[i]);
+   }
+}
+
+// Definitions - x86 SIMD
+
+#ifdef PIXEL_CONVERSION_X86
+
+__attribute__((target("ssse3"))) void convert_bgrx_to_bgr_ssse3(
+      uint8_t const *source, uint8_t *destination, size_t const pixel_count) {
+   // Packs the 12 meaningful bytes of four BGRX pixels at the start of the register, zeroing the rest.
+   __m128i const mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+   size_t i = 0;
+   for (; i + 16 <= pixel_count; i += 16) {
+      auto in = reinterpret_cast<__m128i const *>(source + 4 * i);
+      __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(in), mask);
+      __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), mask);
+      __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), mask);
+      __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), mask);
+      auto out = reinterpret_cast<__m128i *>(destination + 3 * i);
+      _mm_storeu_si128(out, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+      _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+      _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+   }
+   convert_bgrx_to_bgr_scalar(source + 4 * i, destination + 3 * i, pixel_count - i);
+}
+
+void convert_uint16_to_float_sse2(uint16_t const *source, float *destination, size_t const count) {
+   __m128i const zero = _mm_setzero_si128();
+   size_t i = 0;
+   for (; i + 8 <= count; i += 8) {
+      __m128i values = _mm_loadu_si128(reinterpret_cast<__m128i const *>(source + i));
+      _mm_storeu_ps(destination + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero)));
+      _mm_storeu_ps(destination + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero)));
+   }
+   convert_uint16_to_float_scalar(source + i, destination + i, count - i);
+}
+
+__attribute__((target("avx2"))) void convert_uint16_to_float_avx2(
+      uint16_t const *source, float *destination, size_t const count) {
+   size_t i = 0;
+   for (; i + 16 <= count; i += 16) {
+      __m256i low = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(source + i)));
+      __m256i high = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(source + i + 8)));
+      _mm256_storeu_ps(destination + i, _mm256_cvtepi32_ps(low));
+      _mm256_storeu_ps(destination + i + 8, _mm256_cvtepi32_ps(high));
+   }
+   convert_uint16_to_float_sse2(source + i, destination + i, count - i);
+}
+
+#endif
+
+// Definitions - dispatch
+
+bool cpu_supports_ssse3() {
+#ifdef PIXEL_CONVERSION_X86
+   return __builtin_cpu_supports("ssse3");
+#else
+   return false;
+#endif
+}
+
+bool cpu_supports_avx2() {
+#ifdef PIXEL_CONVERSION_X86
+   return __builtin_cpu_supports("avx2");
+#else
+   return false;
+#endif
+}
+
+void convert_bgrx_to_bgr(uint8_t const *source, uint8_t *destination, size_t const pixel_count) {
+   static auto const implementation = [] {
+#ifdef PIXEL_CONVERSION_X86
+      // An AVX2 version was no faster: the shuffles are cheap next to moving the 8 MB of a frame.
+      if (cpu_supports_ssse3()) {
+         return &convert_bgrx_to_bgr_ssse3;
+      }
+#endif
+      return &convert_bgrx_to_bgr_scalar;
+   }();
+   implementation(source, destination, pixel_count);
+}
+
+void convert_uint16_to_float(uint16_t const *source, float *destination, size_t const count) {
+   static auto const implementation = [] {
+#ifdef PIXEL_CONVERSION_X86
+      if (cpu_supports_avx2()) {
+         return &convert_uint16_to_float_avx2;
+      }
+      return &convert_uint16_to_float_sse2;  // SSE2 is part of every x86-64 CPU
+#else
+      return &convert_uint16_to_float_scalar;
+#endif
+   }();
+   implementation(source, destination, count);
+}
+
+char const *bgrx_to_bgr_implementation() {
+   return cpu_supports_ssse3() ? "SSSE3" : "scalar";
+}
+
+char const *uint16_to_float_implementation() {
+#ifdef PIXEL_CONVERSION_X86
+   return cpu_supports_avx2() ? "AVX2" : "SSE2";
+#else
+   return "scalar";
+#endif
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "basic_types.hpp"
+#include "pixel_conversion.hpp"
+
+// Same layout as Picture::ColorFrame::ColorPixel, kept here so that the benchmark doesn't need OpenCV.
+struct ColorPixel {
+   uint8_t blue, green, red;
+};
+
+const size_t color_width = 1920, color_height = 1080;
+const size_t kinect1_width = 640, kinect1_height = 480;
+
+// Runs the function repeatedly for about a second and returns the average time of one run in milliseconds.
+double time_per_run(std::function<void()> const &function) {
+   using clock = std::chrono::steady_clock;
+   function();  // warm-up
+   size_t runs = 0;
+   auto start = clock::now();
+   do {
+      function();
+      ++runs;
+   } while (clock::now() - start < std::chrono::seconds(1));
+   return std::chrono::duration<double, std::milli>(clock::now() - start).count() / runs;
+}
+
+void report(std::string const &name, double milliseconds, double baseline) {
+   std::cout << "  " << name << std::string(name.length() < 28 ? 28 - name.length() : 1, ' ') << milliseconds
+             << " ms/frame (" << baseline / milliseconds << "x)\n";
+}
+
+int main() {
+   std::mt19937 generator(42);
+   std::cout << "Dispatched implementations: " << bgrx_to_bgr_implementation() << " BGRX -> BGR, "
+             << uint16_to_float_implementation() << " uint16 -> float\n\n";
+
+   // BGRX -> BGR, one Kinect v2 color frame.
+   std::vector<uint8_t> bgrx(color_width * color_height * 4);
+   for (auto &byte : bgrx) {
+      byte = static_cast<uint8_t>(generator());
+   }
+   Matrix<ColorPixel> expected(color_height, color_width), pixels(color_height, color_width);
+   auto *data = bgrx.data();
+
+   // The loop Kinect2ColorListener::onNewFrame() used before pixel_conversion.hpp.
+   auto matrix_loop = [&] {
+      for (size_t i = 0; i < color_height; ++i) {
+         for (size_t j = 0; j < color_width; ++j) {
+            size_t pixel_index = 4 * (i * color_width + j);
+            expected[i][j].blue = data[pixel_index];
+            expected[i][j].green = data[pixel_index + 1];
+            expected[i][j].red = data[pixel_index + 2];
+         }
+      }
+   };
+   auto destination = reinterpret_cast<uint8_t *>(pixels.data());
+   size_t const color_bytes = color_width * color_height * sizeof(ColorPixel);
+
+   std::cout << "BGRX -> BGR, " << color_width << "x" << color_height << ":\n";
+   double baseline = time_per_run(matrix_loop);
+   report("Matrix::operator[] loop", baseline, baseline);
+   report("scalar", time_per_run([&] { convert_bgrx_to_bgr_scalar(data, destination, color_width * color_height); }),
+         baseline);
+#ifdef PIXEL_CONVERSION_X86
+   if (cpu_supports_ssse3()) {
+      report("SSSE3", time_per_run([&] { convert_bgrx_to_bgr_ssse3(data, destination, color_width * color_height); }),
+            baseline);
+      if (memcmp(destination, expected.data(), color_bytes) != 0) {
+         std::cerr << "SSSE3 BGRX -> BGR conversion gave a different result\n";
+         return 1;
+      }
+   }
+#endif
+
+   // uint16 -> float, one Kinect v1 depth or IR frame.
+   std::vector<uint16_t> raw(kinect1_width * kinect1_height);
+   for (auto &value : raw) {
+      value = static_cast<uint16_t>(generator() % 10000);
+   }
+   Matrix<float> expected_values(kinect1_height, kinect1_width), values(kinect1_height, kinect1_width);
+   auto *raw_data = raw.data();
+
+   // The loop kinect1_depth_callback() and kinect1_video_callback() used before pixel_conversion.hpp.
+   auto widening_loop = [&] {
+      for (size_t i = 0; i < kinect1_height; ++i) {
+         for (size_t j = 0; j < kinect1_width; ++j) {
+            expected_values[i][j] = float(raw_data[kinect1_width * i + j]);
+         }
+      }
+   };
+   size_t const value_bytes = kinect1_width * kinect1_height * sizeof(float);
+
+   std::cout << "\nuint16 -> float, " << kinect1_width << "x" << kinect1_height << ":\n";
+   baseline = time_per_run(widening_loop);
+   report("Matrix::operator[] loop", baseline, baseline);
+   report("scalar",
+         time_per_run([&] { convert_uint16_to_float_scalar(raw_data, values.data(), kinect1_width * kinect1_height); }),
+         baseline);
+#ifdef PIXEL_CONVERSION_X86
+   report("SSE2",
+         time_per_run([&] { convert_uint16_to_float_sse2(raw_data, values.data(), kinect1_width * kinect1_height); }),
+         baseline);
+   if (memcmp(values.data(), expected_values.data(), value_bytes) != 0) {
+      std::cerr << "SSE2 uint16 -> float conversion gave a different result\n";
+      return 1;
+   }
+   if (cpu_supports_avx2()) {
+      report("AVX2", time_per_run([&] {
+         convert_uint16_to_float_avx2(raw_data, values.data(), kinect1_width * kinect1_height);
+      }),
+            baseline);
+      if (memcmp(values.data(), expected_values.data(), value_bytes) != 0) {
+         std::cerr << "AVX2 uint16 -> float conversion gave a different result\n";
+         return 1;
+      }
+   }
+#endif
+
+   return 0;
+}
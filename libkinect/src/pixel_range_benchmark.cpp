@@ -0,0 +1,129 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <execution>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "basic_types.hpp"
+
+struct FrameSize {
+   size_t width, height;
+};
+
+const FrameSize frame_sizes[] = {{512, 424}, {1920, 1080}};
+
+// Runs the function repeatedly for about a second and returns the average time of one run in milliseconds.
+double time_per_run(std::function<void()> const &function) {
+   using clock = std::chrono::steady_clock;
+   function();  // warm-up
+   size_t runs = 0;
+   auto start = clock::now();
+   do {
+      function();
+      ++runs;
+   } while (clock::now() - start < std::chrono::seconds(1));
+   return std::chrono::duration<double, std::milli>(clock::now() - start).count() / runs;
+}
+
+void report(std::string const &name, double milliseconds, double baseline) {
+   std::cout << "  " << name << std::string(name.length() < 28 ? 28 - name.length() : 1, ' ') << milliseconds
+             << " ms/frame (" << baseline / milliseconds << "x)\n";
+}
+
+// Times function(policy) with each execution policy, against a plain loop.
+template <typename Function>
+void compare_policies(std::string const &name, std::function<void()> const &loop, Function const &function) {
+   std::cout << name << ":\n";
+   double const baseline = time_per_run(loop);
+   report("loop", baseline, baseline);
+   report("std::execution::seq", time_per_run([&] { function(std::execution::seq); }), baseline);
+   report("std::execution::par", time_per_run([&] { function(std::execution::par); }), baseline);
+   report("std::execution::par_unseq", time_per_run([&] { function(std::execution::par_unseq); }), baseline);
+}
+
+int main() {
+   std::mt19937 generator(42);
+   float volatile result = 0.0f;  // keeps the scans from being optimized away
+
+   for (auto const &size : frame_sizes) {
+      Matrix<float> pixels(size.height, size.width);
+      for (auto &pixel : pixels.pixels()) {
+         pixel = static_cast<float>(generator() % 65536);
+      }
+      std::vector<uint8_t> bytes(size.width * size.height);
+      std::string const frame = std::to_string(size.width) + "x" + std::to_string(size.height);
+
+      // The scan file_display and the thumbnailer do for the maximum value.
+      auto const all_pixels = pixels.pixels();
+      compare_policies("Maximum of all pixels, " + frame,
+            [&] {
+               float maximum = 0.0f;
+               for (size_t i = 0; i < size.width * size.height; ++i) {
+                  maximum = std::max(maximum, pixels.data()[i]);
+               }
+               result = maximum;
+            },
+            [&](auto const &policy) {
+               result = std::reduce(policy, all_pixels.begin(), all_pixels.end(), 0.0f,
+                     [](float const a, float const b) { return std::max(a, b); });
+            });
+
+      // The same through a view of the middle quarter of the frame, whose rows have gaps between them.
+      auto const middle = pixels.view(size.height / 4, size.width / 4, size.height / 2, size.width / 2).pixels();
+      compare_policies("Maximum of a strided view, " + frame,
+            [&] {
+               float maximum = 0.0f;
+               for (size_t i = size.height / 4; i < size.height / 4 + size.height / 2; ++i) {
+                  for (size_t j = size.width / 4; j < size.width / 4 + size.width / 2; ++j) {
+                     maximum = std::max(maximum, pixels[i][j]);
+                  }
+               }
+               result = maximum;
+            },
+            [&](auto const &policy) {
+               result = std::reduce(policy, middle.begin(), middle.end(), 0.0f,
+                     [](float const a, float const b) { return std::max(a, b); });
+            });
+
+      // The thumbnailer's conversion to bytes, one row per task.
+      auto to_byte = [](float const pixel) { return static_cast<uint8_t>(std::min(255.0f, pixel / 256.0f)); };
+      compare_policies("Rows to bytes, " + frame,
+            [&] {
+               for (size_t i = 0; i < size.width * size.height; ++i) {
+                  bytes[i] = to_byte(pixels.data()[i]);
+               }
+            },
+            [&](auto const &policy) {
+               std::for_each(policy, pixels.begin(), pixels.end(), [&](Array<float> const row) {
+                  auto const i = static_cast<size_t>(row.begin() - pixels.data());
+                  std::transform(row.begin(), row.end(), bytes.begin() + long(i), to_byte);
+               });
+            });
+      std::cout << "\n";
+   }
+
+   return 0;
+}
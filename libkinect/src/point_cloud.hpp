@@ -0,0 +1,232 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef POINT_CLOUD_HPP
+#define POINT_CLOUD_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "basic_types.hpp"
+#include "parallel.hpp"
+#include "pixel_conversion.hpp"
+
+// Declarations
+
+// Pinhole camera parameters, in pixels.
+struct CameraIntrinsics {
+   float fx, fy, cx, cy;
+};
+
+// Roughly the IR camera of a Kinect v2, for frames which don't come with their device's parameters.
+CameraIntrinsics constexpr kinect2_default_ir_intrinsics{365.5f, 365.5f, 256.0f, 212.0f};
+
+// Arc cosine with an error below 7e-5 rad (Abramowitz & Stegun 4.4.45). x has to be in [-1, 1].
+float fast_acos(float x);
+
+// Row kernels of PointCloud::surface_reflectiveness(): x, y and z point to the rows above, at and below the one
+// computed, result to the computed row. Pixels begin to end - 1 are computed, they need neighbours on both sides.
+void surface_reflectiveness_row_scalar(float const *const x[3], float const *const y[3], float const *const z[3],
+      float *result, size_t begin, size_t end);
+#ifdef PIXEL_CONVERSION_X86
+void surface_reflectiveness_row_avx2(float const *const x[3], float const *const y[3], float const *const z[3],
+      float *result, size_t begin, size_t end);
+#endif
+
+// Turns depth frames into points. The ray through each pixel is computed once; since the camera is a pinhole, the
+// rays of a column share x and the rays of a row share y, so the tables are one value per column and one per row.
+class PointCloud {
+ public:
+   PointCloud(size_t width, size_t height, CameraIntrinsics const &intrinsics);
+
+   // Turns depth in millimetres into points in metres, the same as libfreenect2::Registration::getPointXYZ(): z is
+   // the depth, x grows to the right and y downwards. Pixels without a reading (NaN or at most 1 mm) become NaN.
+   void compute(float const *depth);
+   // The reflectiveness view's correction for the angle of the surface around each pixel, computed from the angles
+   // between its horizontal and its vertical neighbours: 0.5 for sharp edges, 2 * (sum of angles / pi) otherwise, 2
+   // where a neighbour has no reading and 1 on the border of the frame.
+   void surface_reflectiveness(Matrix<float> &reflectiveness) const;
+
+   size_t const width, height;
+   CameraIntrinsics const intrinsics;
+   Matrix<float> x, y, z;  // of the last compute()
+
+ private:
+   std::vector<float> ray_x, ray_y;  // direction of the ray through each column and each row, for z = 1
+};
+
+// Definitions
+
+float fast_acos(float const x) {
+   float const a = std::fabs(x);
+   float const result = std::sqrt(1.0f - a) * (1.5707288f + a * (-0.2121144f + a * (0.0742610f + a * -0.0187293f)));
+   return x < 0.0f ? float(M_PI) - result : result;
+}
+
+PointCloud::PointCloud(size_t const width, size_t const height, CameraIntrinsics const &intrinsics)
+      : width(width), height(height), intrinsics(intrinsics), x(height, width), y(height, width), z(height, width),
+        ray_x(width), ray_y(height) {
+   if (intrinsics.fx <= 0.0f || intrinsics.fy <= 0.0f) {
+      throw std::invalid_argument("PointCloud needs positive focal lengths");
+   }
+   for (size_t j = 0; j < width; ++j) {
+      ray_x[j] = (float(j) + 0.5f - intrinsics.cx) / intrinsics.fx;
+   }
+   for (size_t i = 0; i < height; ++i) {
+      ray_y[i] = (float(i) + 0.5f - intrinsics.cy) / intrinsics.fy;
+   }
+}
+
+void PointCloud::compute(float const *depth) {
+   float const no_reading = std::numeric_limits<float>::quiet_NaN();
+   parallel_for_rows(height, [&](size_t const begin, size_t const end) {
+      for (size_t i = begin; i < end; ++i) {
+         float const *depth_row = depth + i * width;
+         float *x_row = x[i], *y_row = y[i], *z_row = z[i];
+         float const row_ray = ray_y[i];
+         for (size_t j = 0; j < width; ++j) {
+            // NaN fails the comparison too.
+            float const metres = depth_row[j] > 1.0f ? depth_row[j] * 0.001f : no_reading;
+            x_row[j] = metres * ray_x[j];
+            y_row[j] = metres * row_ray;
+            z_row[j] = metres;
+         }
+      }
+   });
+}
+
+void PointCloud::surface_reflectiveness(Matrix<float> &reflectiveness) const {
+   if (reflectiveness.height != height || reflectiveness.width != width) {
+      throw std::invalid_argument("PointCloud::surface_reflectiveness() needs a matrix of the frame's size");
+   }
+   static auto const implementation = [] {
+#ifdef PIXEL_CONVERSION_X86
+      if (cpu_supports_avx2()) {
+         return &surface_reflectiveness_row_avx2;
+      }
+#endif
+      return &surface_reflectiveness_row_scalar;
+   }();
+   parallel_for_rows(height, [&](size_t const begin, size_t const end) {
+      for (size_t i = begin; i < end; ++i) {
+         float *result = reflectiveness[i];
+         if (i == 0 || i + 1 == height || width < 3) {
+            std::fill(result, result + width, 1.0f);
+            continue;
+         }
+         float const *const rows_x[3] = {x[i - 1], x[i], x[i + 1]};
+         float const *const rows_y[3] = {y[i - 1], y[i], y[i + 1]};
+         float const *const rows_z[3] = {z[i - 1], z[i], z[i + 1]};
+         result[0] = result[width - 1] = 1.0f;
+         implementation(rows_x, rows_y, rows_z, result, 1, width - 1);
+      }
+   });
+}
+
+// Definitions - scalar
+
+void surface_reflectiveness_row_scalar(float const *const x[3], float const *const y[3], float const *const z[3],
+      float *const result, size_t const begin, size_t const end) {
+   for (size_t j = begin; j < end; ++j) {
+      float const cx = x[1][j], cy = y[1][j], cz = z[1][j];
+      // Vectors from the point to its left and right neighbours...
+      float const v1x = x[1][j - 1] - cx, v1y = y[1][j - 1] - cy, v1z = z[1][j - 1] - cz;
+      float const w1x = x[1][j + 1] - cx, w1y = y[1][j + 1] - cy, w1z = z[1][j + 1] - cz;
+      // ...and to the ones above and below.
+      float const v2x = x[0][j] - cx, v2y = y[0][j] - cy, v2z = z[0][j] - cz;
+      float const w2x = x[2][j] - cx, w2y = y[2][j] - cy, w2z = z[2][j] - cz;
+
+      float const cos1 = (v1x * w1x + v1y * w1y + v1z * w1z)
+            / std::sqrt((v1x * v1x + v1y * v1y + v1z * v1z) * (w1x * w1x + w1y * w1y + w1z * w1z));
+      float const cos2 = (v2x * w2x + v2y * w2y + v2z * w2z)
+            / std::sqrt((v2x * v2x + v2y * v2y + v2z * v2z) * (w2x * w2x + w2y * w2y + w2z * w2z));
+      if (std::isnan(cos1) || std::isnan(cos2)) {
+         result[j] = 2.0f;
+         continue;
+      }
+      float const angles =
+            (fast_acos(std::min(std::max(cos1, -1.0f), 1.0f)) + fast_acos(std::min(std::max(cos2, -1.0f), 1.0f)))
+            / 3.14f;
+      result[j] = angles < 0.25f ? 0.5f : 2.0f * angles;
+   }
+}
+
+// Definitions - x86 SIMD
+
+#ifdef PIXEL_CONVERSION_X86
+
+// fast_acos() of 8 floats.
+__attribute__((target("avx2"))) __m256 fast_acos_avx2(__m256 const x) {
+   __m256 const a = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+   __m256 polynomial = _mm256_set1_ps(-0.0187293f);
+   polynomial = _mm256_add_ps(_mm256_mul_ps(polynomial, a), _mm256_set1_ps(0.0742610f));
+   polynomial = _mm256_add_ps(_mm256_mul_ps(polynomial, a), _mm256_set1_ps(-0.2121144f));
+   polynomial = _mm256_add_ps(_mm256_mul_ps(polynomial, a), _mm256_set1_ps(1.5707288f));
+   __m256 const result = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), a)), polynomial);
+   __m256 const negative = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ);
+   return _mm256_blendv_ps(result, _mm256_sub_ps(_mm256_set1_ps(float(M_PI)), result), negative);
+}
+
+// Cosine of the angle between the vectors from 8 points to their neighbours in two opposite directions, clamped to
+// [-1, 1] unless it is NaN. Each argument points to the x, y and z of 8 consecutive points.
+__attribute__((target("avx2"))) __m256 neighbours_cosine_avx2(
+      float const *const center[3], float const *const before[3], float const *const after[3]) {
+   __m256 dot = _mm256_setzero_ps(), before_norm = _mm256_setzero_ps(), after_norm = _mm256_setzero_ps();
+   for (size_t k = 0; k < 3; ++k) {
+      __m256 const point = _mm256_loadu_ps(center[k]);
+      __m256 const v = _mm256_sub_ps(_mm256_loadu_ps(before[k]), point);
+      __m256 const w = _mm256_sub_ps(_mm256_loadu_ps(after[k]), point);
+      dot = _mm256_add_ps(dot, _mm256_mul_ps(v, w));
+      before_norm = _mm256_add_ps(before_norm, _mm256_mul_ps(v, v));
+      after_norm = _mm256_add_ps(after_norm, _mm256_mul_ps(w, w));
+   }
+   __m256 const cosine = _mm256_div_ps(dot, _mm256_sqrt_ps(_mm256_mul_ps(before_norm, after_norm)));
+   // min and max return their second argument when either is NaN, so NaN goes through.
+   return _mm256_max_ps(_mm256_set1_ps(-1.0f), _mm256_min_ps(_mm256_set1_ps(1.0f), cosine));
+}
+
+__attribute__((target("avx2"))) void surface_reflectiveness_row_avx2(float const *const x[3],
+      float const *const y[3], float const *const z[3], float *const result, size_t const begin, size_t const end) {
+   size_t j = begin;
+   for (; j + 8 <= end; j += 8) {
+      float const *const center[3] = {x[1] + j, y[1] + j, z[1] + j};
+      float const *const left[3] = {x[1] + j - 1, y[1] + j - 1, z[1] + j - 1};
+      float const *const right[3] = {x[1] + j + 1, y[1] + j + 1, z[1] + j + 1};
+      float const *const above[3] = {x[0] + j, y[0] + j, z[0] + j};
+      float const *const below[3] = {x[2] + j, y[2] + j, z[2] + j};
+      __m256 const cos1 = neighbours_cosine_avx2(center, left, right);
+      __m256 const cos2 = neighbours_cosine_avx2(center, above, below);
+      __m256 const no_reading = _mm256_cmp_ps(cos1, cos2, _CMP_UNORD_Q);  // either of them is NaN
+      __m256 const angles =
+            _mm256_div_ps(_mm256_add_ps(fast_acos_avx2(cos1), fast_acos_avx2(cos2)), _mm256_set1_ps(3.14f));
+      __m256 const sharp = _mm256_cmp_ps(angles, _mm256_set1_ps(0.25f), _CMP_LT_OQ);
+      __m256 value = _mm256_blendv_ps(_mm256_add_ps(angles, angles), _mm256_set1_ps(0.5f), sharp);
+      value = _mm256_blendv_ps(value, _mm256_set1_ps(2.0f), no_reading);
+      _mm256_storeu_ps(result + j, value);
+   }
+   surface_reflectiveness_row_scalar(x, y, z, result, j, end);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,422 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECORDING_HPP
+#define RECORDING_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "picture.hpp"
+
+// Declarations
+
+// A recording keeps a whole capture session in one file (see data_format.md): a file header, one chunk per frame
+// in the order the frames were appended, and a trailing index of the chunks.
+
+enum class RecordingStream { COLOR = 0, DEPTH = 1, IR = 2 };
+
+struct RecordingFileHeader {
+   char magic[4];  // "PHRC"
+   uint32_t version;
+   uint32_t which_kinect;
+   uint8_t padding[52];
+};
+
+struct RecordingFrameHeader {
+   char magic[4];  // "PHFR"
+   uint32_t stream;      // RecordingStream
+   uint32_t pixel_type;  // 0 - BGR bytes, 1 - float, 2 - uint16_t
+   uint32_t width;
+   uint32_t height;
+   uint32_t timestamp;
+   uint32_t sequence;
+   uint32_t reserved;
+   int64_t time_received;  // nanoseconds since the epoch
+   uint64_t payload_size;  // pixel bytes, the chunk is padded to a multiple of 64 bytes after them
+   uint8_t padding[16];
+};
+
+struct RecordingIndexEntry {
+   uint64_t offset;  // of the frame header
+   uint32_t stream;
+   uint32_t reserved;
+};
+
+struct RecordingFooter {
+   uint64_t index_offset;
+   uint64_t frame_count;
+   char magic[4];  // "PHRX"
+   uint32_t version;
+   uint64_t reserved;
+};
+
+static_assert(sizeof(RecordingFileHeader) == 64, "Recording headers must keep the pixels 64-byte aligned");
+static_assert(sizeof(RecordingFrameHeader) == 64, "Recording headers must keep the pixels 64-byte aligned");
+static_assert(sizeof(RecordingIndexEntry) == 16, "Unexpected RecordingIndexEntry padding");
+static_assert(sizeof(RecordingFooter) == 32, "Unexpected RecordingFooter padding");
+
+// Appends frames to a new recording. Safe to use from several threads.
+class RecordingWriter {
+ public:
+   RecordingWriter(std::string const &filename, int which_kinect);
+   RecordingWriter(const RecordingWriter &src) = delete;
+   // Calls close().
+   ~RecordingWriter();
+
+   // Appends every frame present in the picture.
+   void append(Picture const &picture);
+   // Writes the index. Frames can't be appended afterwards.
+   void close();
+
+   size_t frame_count() const;
+
+ private:
+   void append_frame(RecordingStream stream, uint32_t pixel_type, size_t width, size_t height, uint32_t timestamp,
+         uint32_t sequence, std::chrono::time_point<std::chrono::system_clock> time_received, void const *pixels,
+         size_t payload_size);
+
+   mutable std::mutex mutex;
+   std::ofstream file;
+   std::string filename;
+   uint64_t offset = 0;
+   std::vector<RecordingIndexEntry> index;
+   bool closed = false;
+};
+
+// Maps a recording into memory. Frames are returned without copying, their pixels borrow the mapping.
+class RecordingReader {
+ public:
+   explicit RecordingReader(std::string const &filename);
+
+   // All frames, in the order they were recorded.
+   size_t frame_count() const;
+   RecordingStream stream(size_t index) const;
+   // A picture with just the index-th frame.
+   Picture frame(size_t index) const;
+
+   // Frames of one stream.
+   size_t frame_count(RecordingStream stream) const;
+   Picture frame(RecordingStream stream, size_t index) const;
+
+   int which_kinect;
+
+ private:
+   // Used when the index is missing, e.g. because the recording program was killed.
+   void rebuild_index();
+   RecordingFrameHeader const &frame_header(uint64_t offset) const;
+
+   std::string filename;
+   std::shared_ptr<void> mapping;
+   size_t file_size = 0;
+   std::vector<RecordingIndexEntry> index;
+   std::vector<size_t> stream_frames[3];  // positions in index
+};
+
+// Base name used for the files of a picture in the per-file layout, e.g. "2018-05-24-13-45-12-345-kinect2".
+std::string capture_basename(int which_kinect, std::chrono::time_point<std::chrono::system_clock> time_point);
+// Reverses capture_basename(). Returns false if the name doesn't have that format.
+bool parse_capture_basename(std::string const &basename, int &which_kinect,
+      std::chrono::time_point<std::chrono::system_clock> &time_point);
+
+// Definitions - RecordingWriter
+
+RecordingWriter::RecordingWriter(std::string const &filename, int const which_kinect)
+      : file(filename, std::ofstream::binary | std::ofstream::trunc), filename(filename) {
+   if (!file) {
+      throw std::runtime_error("Could not create recording " + filename);
+   }
+   RecordingFileHeader header{};
+   memcpy(header.magic, "PHRC", 4);
+   header.version = 1;
+   header.which_kinect = static_cast<uint32_t>(which_kinect);
+   file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+   offset = sizeof(header);
+}
+
+RecordingWriter::~RecordingWriter() {
+   try {
+      close();
+   } catch (std::exception const &e) {
+      std::cerr << "RecordingWriter::close() failed: " << e.what() << '\n';
+   }
+}
+
+void RecordingWriter::append(Picture const &picture) {
+   if (picture.color_frame) {
+      auto const &frame = *picture.color_frame;
+      append_frame(RecordingStream::COLOR, 0, frame.pixels->width, frame.pixels->height, frame.timestamp,
+            frame.sequence, frame.time_received, frame.pixels->data(),
+            frame.pixels->width * frame.pixels->height * sizeof(Picture::ColorFrame::ColorPixel));
+   }
+   for (auto const *depth_or_ir : {&picture.depth_frame, &picture.ir_frame}) {
+      if (!*depth_or_ir) {
+         continue;
+      }
+      auto const &frame = **depth_or_ir;
+      frame.visit_pixels([&](auto const &matrix) {
+         bool const is_uint16 = sizeof(*matrix.data()) == sizeof(uint16_t);
+         append_frame(frame.is_depth ? RecordingStream::DEPTH : RecordingStream::IR, is_uint16 ? 2 : 1, matrix.width,
+               matrix.height, frame.timestamp, frame.sequence, frame.time_received, matrix.data(),
+               matrix.width * matrix.height * sizeof(*matrix.data()));
+      });
+   }
+}
+
+void RecordingWriter::append_frame(RecordingStream const stream, uint32_t const pixel_type, size_t const width,
+      size_t const height, uint32_t const timestamp, uint32_t const sequence,
+      std::chrono::time_point<std::chrono::system_clock> const time_received, void const *const pixels,
+      size_t const payload_size) {
+   RecordingFrameHeader header{};
+   memcpy(header.magic, "PHFR", 4);
+   header.stream = static_cast<uint32_t>(stream);
+   header.pixel_type = pixel_type;
+   header.width = static_cast<uint32_t>(width);
+   header.height = static_cast<uint32_t>(height);
+   header.timestamp = timestamp;
+   header.sequence = sequence;
+   header.time_received =
+         std::chrono::duration_cast<std::chrono::nanoseconds>(time_received.time_since_epoch()).count();
+   header.payload_size = payload_size;
+   char const padding[64] = {};
+   size_t const padding_size = (64 - payload_size % 64) % 64;
+
+   std::lock_guard<std::mutex> lock(mutex);
+   if (closed) {
+      throw std::logic_error("Recording " + filename + " is already closed");
+   }
+   file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+   file.write(static_cast<char const *>(pixels), static_cast<std::streamsize>(payload_size));
+   file.write(padding, static_cast<std::streamsize>(padding_size));
+   if (!file) {
+      throw std::runtime_error("Could not write to recording " + filename);
+   }
+   index.push_back(RecordingIndexEntry{offset, header.stream, 0});
+   offset += sizeof(header) + payload_size + padding_size;
+}
+
+void RecordingWriter::close() {
+   std::lock_guard<std::mutex> lock(mutex);
+   if (closed) {
+      return;
+   }
+   closed = true;
+   RecordingFooter footer{};
+   footer.index_offset = offset;
+   footer.frame_count = index.size();
+   memcpy(footer.magic, "PHRX", 4);
+   footer.version = 1;
+   file.write(reinterpret_cast<char const *>(index.data()),
+         static_cast<std::streamsize>(index.size() * sizeof(RecordingIndexEntry)));
+   file.write(reinterpret_cast<char const *>(&footer), sizeof(footer));
+   file.close();
+   if (!file) {
+      throw std::runtime_error("Could not write the index of recording " + filename);
+   }
+}
+
+size_t RecordingWriter::frame_count() const {
+   std::lock_guard<std::mutex> lock(mutex);
+   return index.size();
+}
+
+// Definitions - RecordingReader
+
+RecordingReader::RecordingReader(std::string const &filename) : filename(filename) {
+   int descriptor = open(filename.c_str(), O_RDONLY);
+   if (descriptor < 0) {
+      throw std::runtime_error("Error reading file " + filename);
+   }
+   struct stat file_status {};
+   if (fstat(descriptor, &file_status) != 0 || size_t(file_status.st_size) < sizeof(RecordingFileHeader)) {
+      ::close(descriptor);
+      throw std::runtime_error("File " + filename + " is not a recording");
+   }
+   file_size = static_cast<size_t>(file_status.st_size);
+   // Private and writable, so that frames can be modified in place without touching the file.
+   void *memory = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+   ::close(descriptor);
+   if (memory == MAP_FAILED) {
+      throw std::runtime_error("mmap() failed for file " + filename);
+   }
+   size_t const size = file_size;
+   mapping = std::shared_ptr<void>(memory, [size](void *released) { munmap(released, size); });
+
+   auto const &header = *static_cast<RecordingFileHeader const *>(memory);
+   if (memcmp(header.magic, "PHRC", 4) != 0 || header.version != 1) {
+      throw std::invalid_argument("File " + filename + " is not a recording");
+   }
+   which_kinect = static_cast<int>(header.which_kinect);
+
+   auto const *bytes = static_cast<uint8_t const *>(memory);
+   RecordingFooter footer{};
+   if (file_size >= sizeof(RecordingFileHeader) + sizeof(RecordingFooter)) {
+      memcpy(&footer, bytes + file_size - sizeof(RecordingFooter), sizeof(footer));
+   }
+   if (memcmp(footer.magic, "PHRX", 4) == 0 && footer.index_offset <= file_size - sizeof(RecordingFooter)
+         && footer.frame_count == (file_size - sizeof(RecordingFooter) - footer.index_offset)
+                     / sizeof(RecordingIndexEntry)) {
+      auto const *entries = reinterpret_cast<RecordingIndexEntry const *>(bytes + footer.index_offset);
+      index.assign(entries, entries + footer.frame_count);
+   } else {
+      std::cerr << "Recording " << filename << " has no index, scanning it\n";
+      rebuild_index();
+   }
+   for (size_t i = 0; i < index.size(); ++i) {
+      if (index[i].stream > 2) {
+         throw std::invalid_argument("Recording " + filename + " has an invalid index");
+      }
+      stream_frames[index[i].stream].push_back(i);
+   }
+}
+
+void RecordingReader::rebuild_index() {
+   auto const *bytes = static_cast<uint8_t const *>(mapping.get());
+   uint64_t offset = sizeof(RecordingFileHeader);
+   while (offset + sizeof(RecordingFrameHeader) <= file_size) {
+      auto const &header = *reinterpret_cast<RecordingFrameHeader const *>(bytes + offset);
+      uint64_t const chunk_size = sizeof(header) + (header.payload_size + 63) / 64 * 64;
+      if (memcmp(header.magic, "PHFR", 4) != 0 || header.stream > 2 || offset + chunk_size > file_size) {
+         break;  // the rest was cut off
+      }
+      index.push_back(RecordingIndexEntry{offset, header.stream, 0});
+      offset += chunk_size;
+   }
+}
+
+RecordingFrameHeader const &RecordingReader::frame_header(uint64_t const offset) const {
+   if (offset + sizeof(RecordingFrameHeader) > file_size) {
+      throw std::invalid_argument("Recording " + filename + " has an invalid index");
+   }
+   auto const &header =
+         *reinterpret_cast<RecordingFrameHeader const *>(static_cast<uint8_t const *>(mapping.get()) + offset);
+   if (memcmp(header.magic, "PHFR", 4) != 0 || offset + sizeof(header) + header.payload_size > file_size) {
+      throw std::invalid_argument("Recording " + filename + " has a damaged frame");
+   }
+   return header;
+}
+
+size_t RecordingReader::frame_count() const {
+   return index.size();
+}
+
+RecordingStream RecordingReader::stream(size_t const index) const {
+   return static_cast<RecordingStream>(this->index.at(index).stream);
+}
+
+Picture RecordingReader::frame(size_t const index) const {
+   uint64_t const offset = this->index.at(index).offset;
+   auto const &header = frame_header(offset);
+   size_t const height = header.height, width = header.width;
+   auto *pixels = static_cast<uint8_t *>(mapping.get()) + offset + sizeof(header);
+   size_t const element_size = header.pixel_type == 2 ? sizeof(uint16_t) : header.pixel_type == 1 ? sizeof(float) : 3;
+   if (header.payload_size != height * width * element_size) {
+      throw std::invalid_argument("Recording " + filename + " has a damaged frame");
+   }
+
+   Picture picture;
+   std::chrono::time_point<std::chrono::system_clock> time_received(
+         std::chrono::duration_cast<std::chrono::system_clock::duration>(
+               std::chrono::nanoseconds(header.time_received)));
+   if (header.stream == uint32_t(RecordingStream::COLOR)) {
+      auto frame = new Picture::ColorFrame(new Matrix<Picture::ColorFrame::ColorPixel>(
+            height, width, reinterpret_cast<Picture::ColorFrame::ColorPixel *>(pixels), mapping));
+      frame->time_received = time_received;
+      frame->timestamp = header.timestamp;
+      frame->sequence = header.sequence;
+      picture.color_frame.reset(frame);
+      return picture;
+   }
+   bool const is_depth = header.stream == uint32_t(RecordingStream::DEPTH);
+   Picture::DepthOrIrFrame *frame;
+   if (header.pixel_type == 2) {
+      frame = new Picture::DepthOrIrFrame(
+            new Matrix<uint16_t>(height, width, reinterpret_cast<uint16_t *>(pixels), mapping), is_depth);
+   } else {
+      frame = new Picture::DepthOrIrFrame(
+            new Matrix<float>(height, width, reinterpret_cast<float *>(pixels), mapping), is_depth);
+   }
+   frame->time_received = time_received;
+   frame->timestamp = header.timestamp;
+   frame->sequence = header.sequence;
+   frame->which_kinect = which_kinect;
+   if (is_depth) {
+      picture.depth_frame.reset(frame);
+   } else {
+      picture.ir_frame.reset(frame);
+   }
+   return picture;
+}
+
+size_t RecordingReader::frame_count(RecordingStream const stream) const {
+   return stream_frames[static_cast<size_t>(stream)].size();
+}
+
+Picture RecordingReader::frame(RecordingStream const stream, size_t const index) const {
+   return frame(stream_frames[static_cast<size_t>(stream)].at(index));
+}
+
+// Definitions - per-file layout
+
+std::string capture_basename(int const which_kinect, std::chrono::time_point<std::chrono::system_clock> time_point) {
+   auto time_point_as_time_t = std::chrono::system_clock::to_time_t(time_point);
+   char current_time_char[100];
+   std::strftime(current_time_char, sizeof(current_time_char), "%Y-%m-%d-%H-%M-%S", std::gmtime(&time_point_as_time_t));
+   std::string current_time_string = current_time_char;
+
+   current_time_string += '-';
+   std::string milliseconds = std::to_string(
+         std::chrono::duration_cast<std::chrono::milliseconds>(time_point.time_since_epoch()).count() % 1000);
+   current_time_string += std::string(3 - milliseconds.length(), '0') + milliseconds;
+
+   return current_time_string + "-kinect" + std::to_string(which_kinect);
+}
+
+bool parse_capture_basename(std::string const &basename, int &which_kinect,
+      std::chrono::time_point<std::chrono::system_clock> &time_point) {
+   std::tm time{};
+   int milliseconds = 0, characters_read = 0;
+   if (sscanf(basename.c_str(), "%4d-%2d-%2d-%2d-%2d-%2d-%3d-kinect%d%n", &time.tm_year, &time.tm_mon, &time.tm_mday,
+             &time.tm_hour, &time.tm_min, &time.tm_sec, &milliseconds, &which_kinect, &characters_read)
+               != 8
+         || size_t(characters_read) != basename.length()) {
+      return false;
+   }
+   time.tm_year -= 1900;
+   time.tm_mon -= 1;
+   time_point = std::chrono::system_clock::from_time_t(timegm(&time)) + std::chrono::milliseconds(milliseconds);
+   return true;
+}
+
+#endif
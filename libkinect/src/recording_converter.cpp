@@ -0,0 +1,130 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "picture.hpp"
+#include "recording.hpp"
+
+// Converts between recordings and the per-file layout written by live_display (one .png, .depth[.gz] or .ir[.gz]
+// file per frame, named by capture_basename()).
+
+void usage() {
+   std::cerr << "Usage:\n"
+             << "  recording_converter pack <photos directory> <recording>\n"
+             << "  recording_converter unpack <recording> <photos directory>\n";
+}
+
+// Splits "name.depth.gz" into "name" and ".depth".
+bool split_filename(std::string filename, std::string &basename, std::string &extension) {
+   if (filename.length() > 3 && filename.compare(filename.length() - 3, 3, ".gz") == 0) {
+      filename.erase(filename.length() - 3);
+   }
+   auto dot = filename.rfind('.');
+   if (dot == std::string::npos) {
+      return false;
+   }
+   basename = filename.substr(0, dot);
+   extension = filename.substr(dot);
+   return extension == ".png" || extension == ".depth" || extension == ".ir";
+}
+
+int pack(std::string const &directory, std::string const &recording_filename) {
+   struct Capture {
+      std::chrono::time_point<std::chrono::system_clock> time_point;
+      std::string path;
+      std::string extension;
+      int which_kinect;
+   };
+   std::vector<Capture> captures;
+   for (auto const &entry : std::filesystem::directory_iterator(directory)) {
+      std::string basename, extension;
+      Capture capture;
+      if (!entry.is_regular_file() || !split_filename(entry.path().filename().string(), basename, extension)
+            || !parse_capture_basename(basename, capture.which_kinect, capture.time_point)) {
+         continue;
+      }
+      capture.path = entry.path().string();
+      capture.extension = extension;
+      captures.push_back(capture);
+   }
+   if (captures.empty()) {
+      std::cerr << "No photos found in " << directory << '\n';
+      return 1;
+   }
+   std::stable_sort(captures.begin(), captures.end(),
+         [](Capture const &a, Capture const &b) { return a.time_point < b.time_point; });
+
+   RecordingWriter writer(recording_filename, captures.front().which_kinect);
+   for (auto const &capture : captures) {
+      Picture picture;
+      if (capture.extension == ".png") {
+         picture.color_frame.reset(new Picture::ColorFrame(capture.path));
+         picture.color_frame.mutate()->time_received = capture.time_point;
+      } else {
+         picture.depth_frame.reset(new Picture::DepthOrIrFrame(capture.path));
+         picture.depth_frame.mutate()->time_received = capture.time_point;
+         if (!picture.depth_frame->is_depth) {
+            std::swap(picture.depth_frame, picture.ir_frame);
+         }
+      }
+      writer.append(picture);
+   }
+   writer.close();
+   std::cout << "Packed " << writer.frame_count() << " frames into " << recording_filename << '\n';
+   return 0;
+}
+
+int unpack(std::string const &recording_filename, std::string const &directory) {
+   RecordingReader reader(recording_filename);
+   std::filesystem::create_directories(directory);
+   for (size_t i = 0; i < reader.frame_count(); ++i) {
+      Picture picture = reader.frame(i);
+      auto time_received = picture.color_frame ? picture.color_frame->time_received
+            : picture.depth_frame                ? picture.depth_frame->time_received
+                                                 : picture.ir_frame->time_received;
+      picture.save_all_to_files(directory + "/" + capture_basename(reader.which_kinect, time_received));
+   }
+   std::cout << "Unpacked " << reader.frame_count() << " frames into " << directory << '\n';
+   return 0;
+}
+
+int main(int argc, char **argv) {
+   if (argc != 4) {
+      usage();
+      return 1;
+   }
+   std::string command = argv[1];
+   try {
+      if (command == "pack") {
+         return pack(argv[2], argv[3]);
+      } else if (command == "unpack") {
+         return unpack(argv[2], argv[3]);
+      }
+   } catch (std::exception const &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+   }
+   usage();
+   return 1;
+}
@@ -0,0 +1,280 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef REPLAY_SOURCE_HPP
+#define REPLAY_SOURCE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "picture.hpp"
+#include "recording.hpp"
+
+// Declarations
+
+enum class ReplayTiming {
+   ORIGINAL,            // frames are delivered with the intervals they were recorded with
+   AS_FAST_AS_POSSIBLE  // each frame is delivered right after the previous one
+};
+
+// Plays back a recording (see recording.hpp) or a directory of photos saved by live_display. Delivered frames get
+// a new time_received, like frames coming from a device. Frames saved without a device timestamp and sequence
+// number get ones made up from the time they were received and their position in the stream. When looping, each
+// pass moves timestamps and sequence numbers on by the span of the previous one, so that they keep increasing.
+class ReplaySource : public FrameSource {
+ public:
+   ReplaySource(std::string const &path, ReplayTiming timing, bool loop = false);
+   ~ReplaySource() override;
+
+   void start(bool color, bool depth, bool ir, std::function<void(Picture)> deliver) override;
+   void stop() override;
+   int which_kinect() const override;
+
+   // True once every frame has been delivered (never when looping).
+   bool finished() const;
+   uint64_t frames_delivered() const;
+
+   ReplayTiming const timing;
+   bool const loop;
+
+ private:
+   struct Entry {
+      RecordingStream stream;
+      std::chrono::time_point<std::chrono::system_clock> time_received;
+      size_t recording_index;  // when playing back a recording
+      std::string path;        // when playing back a directory
+   };
+
+   void scan_directory(std::string const &path);
+   Picture load(Entry const &entry) const;
+   void playback_loop(bool color, bool depth, bool ir, std::function<void(Picture)> deliver);
+
+   std::unique_ptr<RecordingReader> recording;
+   std::vector<Entry> entries;
+   int recorded_kinect = 0;
+
+   std::thread playback_thread;
+   std::mutex mutex;
+   std::condition_variable stop_requested;
+   bool stopping = false;
+   std::atomic<bool> all_delivered{false};
+   std::atomic<uint64_t> delivered_count{0};
+};
+
+// Definitions
+
+ReplaySource::ReplaySource(std::string const &path, ReplayTiming const timing, bool const loop)
+      : timing(timing), loop(loop) {
+   if (std::filesystem::is_directory(path)) {
+      scan_directory(path);
+   } else {
+      recording.reset(new RecordingReader(path));
+      recorded_kinect = recording->which_kinect;
+      for (size_t i = 0; i < recording->frame_count(); ++i) {
+         Picture picture = recording->frame(i);
+         auto time_received = picture.color_frame ? picture.color_frame->time_received
+               : picture.depth_frame                ? picture.depth_frame->time_received
+                                                    : picture.ir_frame->time_received;
+         entries.push_back(Entry{recording->stream(i), time_received, i, ""});
+      }
+   }
+   if (entries.empty()) {
+      throw std::invalid_argument("No frames to replay in " + path);
+   }
+}
+
+ReplaySource::~ReplaySource() {
+   stop();
+}
+
+void ReplaySource::scan_directory(std::string const &path) {
+   for (auto const &directory_entry : std::filesystem::directory_iterator(path)) {
+      std::string filename = directory_entry.path().filename().string();
+      if (!directory_entry.is_regular_file()) {
+         continue;
+      }
+      if (filename.length() > 3 && filename.compare(filename.length() - 3, 3, ".gz") == 0) {
+         filename.erase(filename.length() - 3);
+      }
+      auto dot = filename.rfind('.');
+      if (dot == std::string::npos) {
+         continue;
+      }
+      std::string extension = filename.substr(dot);
+      Entry entry{RecordingStream::COLOR, {}, 0, directory_entry.path().string()};
+      if (extension == ".depth") {
+         entry.stream = RecordingStream::DEPTH;
+      } else if (extension == ".ir") {
+         entry.stream = RecordingStream::IR;
+      } else if (extension != ".png") {
+         continue;
+      }
+      int file_kinect;
+      if (!parse_capture_basename(filename.substr(0, dot), file_kinect, entry.time_received)) {
+         continue;
+      }
+      recorded_kinect = file_kinect;
+      entries.push_back(entry);
+   }
+   std::stable_sort(entries.begin(), entries.end(),
+         [](Entry const &a, Entry const &b) { return a.time_received < b.time_received; });
+}
+
+int ReplaySource::which_kinect() const {
+   return recorded_kinect;
+}
+
+bool ReplaySource::finished() const {
+   return all_delivered;
+}
+
+uint64_t ReplaySource::frames_delivered() const {
+   return delivered_count;
+}
+
+void ReplaySource::start(bool const color, bool const depth, bool const ir, std::function<void(Picture)> deliver) {
+   stop();
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = false;
+   }
+   all_delivered = false;
+   playback_thread = std::thread(&ReplaySource::playback_loop, this, color, depth, ir, std::move(deliver));
+}
+
+void ReplaySource::stop() {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   stop_requested.notify_all();
+   if (playback_thread.joinable()) {
+      playback_thread.join();
+   }
+}
+
+Picture ReplaySource::load(Entry const &entry) const {
+   if (recording) {
+      return recording->frame(entry.recording_index);
+   }
+   Picture picture;
+   if (entry.stream == RecordingStream::COLOR) {
+      picture.color_frame.reset(new Picture::ColorFrame(entry.path));
+   } else {
+      auto frame = new Picture::DepthOrIrFrame(entry.path);
+      (frame->is_depth ? picture.depth_frame : picture.ir_frame).reset(frame);
+   }
+   return picture;
+}
+
+void ReplaySource::playback_loop(
+      bool const color, bool const depth, bool const ir, std::function<void(Picture)> deliver) {
+   bool const streams[3] = {color, depth, ir};
+   uint32_t timestamp_offset = 0, sequence_offset = 0;
+   do {
+      uint32_t stream_positions[3] = {0, 0, 0};
+      // Timestamps and sequences of the pass, relative to its first frame: all streams share one offset, so that
+      // frames of one moment keep matching.
+      bool stamped = false;
+      uint32_t first_timestamp = 0, first_sequence = 0;
+      int64_t lowest_timestamp = 0, highest_timestamp = 0, lowest_sequence = 0, highest_sequence = 0;
+      auto const started = std::chrono::steady_clock::now();
+      auto const first_time_received = entries.front().time_received;
+      for (auto const &entry : entries) {
+         auto const stream = static_cast<size_t>(entry.stream);
+         if (!streams[stream]) {
+            continue;
+         }
+         if (timing == ReplayTiming::ORIGINAL) {
+            std::unique_lock<std::mutex> lock(mutex);
+            stop_requested.wait_until(lock, started + (entry.time_received - first_time_received),
+                  [this] { return stopping; });
+         }
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+               return;
+            }
+         }
+
+         Picture picture;
+         try {
+            picture = load(entry);
+         } catch (std::exception const &e) {
+            std::cerr << "ReplaySource could not load a frame: " << e.what() << '\n';
+            continue;
+         }
+         uint32_t const position = stream_positions[stream]++;
+         auto restamp = [&](auto &frame) {
+            if (frame.timestamp == 0 && frame.sequence == 0) {
+               // libfreenect2 counts timestamps in units of 0.1 ms.
+               frame.timestamp = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                     entry.time_received.time_since_epoch()).count() / 100);
+               frame.sequence = position;
+            }
+            if (!stamped) {
+               first_timestamp = frame.timestamp;
+               first_sequence = frame.sequence;
+               stamped = true;
+            }
+            // Compared as signed differences, so that they can wrap around.
+            int64_t const timestamp = static_cast<int32_t>(frame.timestamp - first_timestamp);
+            int64_t const sequence = static_cast<int32_t>(frame.sequence - first_sequence);
+            lowest_timestamp = std::min(lowest_timestamp, timestamp);
+            highest_timestamp = std::max(highest_timestamp, timestamp);
+            lowest_sequence = std::min(lowest_sequence, sequence);
+            highest_sequence = std::max(highest_sequence, sequence);
+            frame.timestamp += timestamp_offset;
+            frame.sequence += sequence_offset;
+            frame.time_received = std::chrono::system_clock::now();
+         };
+         if (picture.color_frame) {
+            restamp(*picture.color_frame.mutate());
+         } else if (picture.depth_frame) {
+            restamp(*picture.depth_frame.mutate());
+         } else {
+            restamp(*picture.ir_frame.mutate());
+         }
+         deliver(std::move(picture));
+         ++delivered_count;
+      }
+      if (stamped) {
+         // The next pass starts one frame interval after this one ends, as if the recording went on.
+         uint32_t const frames = *std::max_element(stream_positions, stream_positions + 3);
+         int64_t const span = highest_timestamp - lowest_timestamp;
+         timestamp_offset += static_cast<uint32_t>(span + (frames > 1 ? std::max<int64_t>(1, span / (frames - 1)) : 1));
+         sequence_offset += static_cast<uint32_t>(highest_sequence - lowest_sequence + 1);
+      }
+   } while (loop);
+   all_delivered = true;
+}
+
+#endif
@@ -0,0 +1,313 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYNTHETIC_SOURCE_HPP
+#define SYNTHETIC_SOURCE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "picture.hpp"
+
+// Declarations
+
+enum class SyntheticScene {
+   SPHERES,  // spheres moving in circles in front of a wall
+   FACE      // a face-shaped depth blob swaying in front of a wall
+};
+
+struct SyntheticSettings {
+   int which_kinect = 2;  // Kinect v1 frames have uint16_t pixels, Kinect v2 frames have float pixels
+   size_t depth_width = 512, depth_height = 424;
+   size_t color_width = 1920, color_height = 1080;
+   double fps = 30.0;  // 0 means as fast as possible
+   SyntheticScene scene = SyntheticScene::SPHERES;
+   size_t sphere_count = 1;
+   float depth_noise = 5.0f;     // standard deviation, in millimetres
+   double hole_fraction = 0.02;  // share of depth and IR pixels without a reading
+   uint32_t seed = 1;
+   uint64_t frame_limit = 0;  // 0 means no limit
+};
+
+// Generates depth, IR and color frames of a simple scene. Frame n is the same in every run with the same settings,
+// regardless of timing. Frames of one moment share their sequence number and device timestamp.
+class SyntheticSource : public FrameSource {
+ public:
+   explicit SyntheticSource(SyntheticSettings const &settings);
+   ~SyntheticSource() override;
+
+   void start(bool color, bool depth, bool ir, std::function<void(Picture)> deliver) override;
+   void stop() override;
+   int which_kinect() const override;
+
+   // Frames of moment n.
+   Picture generate(uint64_t n, bool color, bool depth, bool ir) const;
+   bool finished() const;
+   uint64_t frames_delivered() const;
+
+   SyntheticSettings const settings;
+
+ private:
+   // Distance from the camera in millimetres at normalized image coordinates (0-1), and the surface's albedo.
+   float scene_depth(double u, double v, uint64_t n, float &albedo) const;
+   void generation_loop(bool color, bool depth, bool ir, std::function<void(Picture)> deliver);
+
+   static size_t constexpr table_slack = 4096;
+   std::vector<float> noise_table;
+   std::vector<uint8_t> hole_table;
+   std::vector<size_t> color_columns;  // depth column shown in each color column
+
+   std::thread generation_thread;
+   std::mutex mutex;
+   std::condition_variable stop_requested;
+   bool stopping = false;
+   std::atomic<bool> all_delivered{false};
+   std::atomic<uint64_t> delivered_count{0};
+};
+
+// Definitions
+
+SyntheticSource::SyntheticSource(SyntheticSettings const &settings) : settings(settings) {
+   if (settings.which_kinect != 1 && settings.which_kinect != 2) {
+      throw std::invalid_argument("SyntheticSource can only imitate Kinect v1 or v2");
+   }
+   if (settings.depth_width == 0 || settings.depth_height == 0 || settings.color_width == 0
+         || settings.color_height == 0) {
+      throw std::invalid_argument("SyntheticSource frame sizes must be positive");
+   }
+   // Drawing noise for every pixel of every frame would make the generator the bottleneck at high frame rates, so
+   // each frame reads the tables from its own random offset instead.
+   std::mt19937 generator(settings.seed);
+   std::normal_distribution<float> noise(0.0f, settings.depth_noise);
+   std::bernoulli_distribution hole(settings.hole_fraction);
+   size_t const table_size = settings.depth_width * settings.depth_height + table_slack;
+   noise_table.resize(table_size);
+   hole_table.resize(table_size);
+   for (size_t k = 0; k < table_size; ++k) {
+      noise_table[k] = noise(generator);
+      hole_table[k] = hole(generator);
+   }
+   color_columns.resize(settings.color_width);
+   for (size_t j = 0; j < settings.color_width; ++j) {
+      color_columns[j] = j * settings.depth_width / settings.color_width;
+   }
+}
+
+SyntheticSource::~SyntheticSource() {
+   stop();
+}
+
+int SyntheticSource::which_kinect() const {
+   return settings.which_kinect;
+}
+
+bool SyntheticSource::finished() const {
+   return all_delivered;
+}
+
+uint64_t SyntheticSource::frames_delivered() const {
+   return delivered_count;
+}
+
+float SyntheticSource::scene_depth(double const u, double const v, uint64_t const n, float &albedo) const {
+   float const wall = 2500.0f;
+   double const phase = 2.0 * M_PI * double(n) / 90.0;  // one loop every 3 seconds at 30 fps
+   float depth = wall;
+   albedo = 0.6f;
+   if (settings.scene == SyntheticScene::SPHERES) {
+      for (size_t i = 0; i < settings.sphere_count; ++i) {
+         double const offset = 2.0 * M_PI * double(i) / double(settings.sphere_count);
+         double const center_u = 0.5 + 0.25 * std::cos(phase + offset);
+         double const center_v = 0.5 + 0.25 * std::sin(phase + offset);
+         double const radius = 0.15 / std::sqrt(double(settings.sphere_count));
+         double const du = u - center_u, dv = v - center_v, squared = du * du + dv * dv;
+         if (squared < radius * radius) {
+            auto const surface = float(1000.0 + 250.0 * i - 2000.0 * std::sqrt(radius * radius - squared));
+            if (surface < depth) {
+               depth = surface;
+               albedo = 0.9f;
+            }
+         }
+      }
+   } else {
+      // An ellipsoid head with a nose bump and eye sockets.
+      double const center_u = 0.5 + 0.05 * std::sin(phase), center_v = 0.5;
+      double const du = (u - center_u) / 0.16, dv = (v - center_v) / 0.24, squared = du * du + dv * dv;
+      if (squared < 1.0) {
+         double surface = 900.0 - 120.0 * std::sqrt(1.0 - squared);
+         surface -= 35.0 * std::exp(-(du * du + (dv - 0.05) * (dv - 0.05)) / 0.01);
+         surface += 15.0 * std::exp(-((du - 0.35) * (du - 0.35) + (dv + 0.25) * (dv + 0.25)) / 0.01);
+         surface += 15.0 * std::exp(-((du + 0.35) * (du + 0.35) + (dv + 0.25) * (dv + 0.25)) / 0.01);
+         depth = float(surface);
+         albedo = 0.8f;
+      }
+   }
+   return depth;
+}
+
+Picture SyntheticSource::generate(uint64_t const n, bool const color, bool const depth, bool const ir) const {
+   // Seeding with the frame number keeps frames reproducible no matter which frames were generated before.
+   std::mt19937 generator(settings.seed ^ static_cast<uint32_t>(n * 2654435761u));
+   std::uniform_int_distribution<size_t> table_offset(0, table_slack - 1);
+   float const *noise = noise_table.data() + table_offset(generator);
+   uint8_t const *holes = hole_table.data() + table_offset(generator);
+   auto const sequence = static_cast<uint32_t>(n);
+   double const fps = settings.fps > 0.0 ? settings.fps : 30.0;
+   auto const timestamp = static_cast<uint32_t>(double(n) * 10000.0 / fps);  // libfreenect2 units of 0.1 ms
+
+   // The scene is only evaluated at depth resolution, color frames are scaled up from it.
+   size_t const width = settings.depth_width, height = settings.depth_height;
+   Matrix<float> depth_values(height, width), ir_values(height, width);
+   Matrix<uint8_t> shades(height, width);
+   float const ir_scale = settings.which_kinect == 1 ? 1023.0f : 65535.0f;
+   for (size_t i = 0; i < height; ++i) {
+      for (size_t j = 0; j < width; ++j) {
+         float albedo;
+         float const value = scene_depth((j + 0.5) / width, (i + 0.5) / height, n, albedo);
+         shades[i][j] = static_cast<uint8_t>(std::min(255.0f, 255.0f * albedo * 900.0f / value));
+         size_t const k = i * width + j;
+         if (holes[k]) {
+            depth_values[i][j] = 0.0f;
+            ir_values[i][j] = 0.0f;
+            continue;
+         }
+         float const noisy = value + noise[k];
+         depth_values[i][j] = noisy;
+         // Reflected light falls off with the square of the distance.
+         ir_values[i][j] = std::min(ir_scale, ir_scale * albedo * (800.0f * 800.0f) / (noisy * noisy));
+      }
+   }
+
+   Picture picture;
+   auto make_frame = [&](Matrix<float> &values, bool is_depth) {
+      Picture::DepthOrIrFrame *frame;
+      if (settings.which_kinect == 1) {
+         auto pixels = new Matrix<uint16_t>(height, width);
+         for (size_t k = 0; k < width * height; ++k) {
+            pixels->data()[k] = static_cast<uint16_t>(std::max(0.0f, values.data()[k]));
+         }
+         frame = new Picture::DepthOrIrFrame(pixels, is_depth);
+      } else {
+         frame = new Picture::DepthOrIrFrame(new Matrix<float>(std::move(values)), is_depth);
+      }
+      frame->timestamp = timestamp;
+      frame->sequence = sequence;
+      frame->which_kinect = settings.which_kinect;
+      return frame;
+   };
+   if (depth) {
+      picture.depth_frame.reset(make_frame(depth_values, true));
+   }
+   if (ir) {
+      picture.ir_frame.reset(make_frame(ir_values, false));
+   }
+   if (color) {
+      size_t const color_width = settings.color_width, color_height = settings.color_height;
+      auto pixels = new Matrix<Picture::ColorFrame::ColorPixel>(color_height, color_width);
+      size_t previous_row = height;
+      for (size_t i = 0; i < color_height; ++i) {
+         size_t const row = i * height / color_height;
+         if (row == previous_row) {
+            std::copy((*pixels)[i - 1], (*pixels)[i - 1] + color_width, (*pixels)[i]);
+            continue;
+         }
+         previous_row = row;
+         for (size_t j = 0; j < color_width; ++j) {
+            uint8_t const shade = shades[row][color_columns[j]];
+            // Warm, roughly skin-coloured.
+            (*pixels)[i][j] = Picture::ColorFrame::ColorPixel{uint8_t(shade / 2), uint8_t(shade * 3 / 4), shade};
+         }
+      }
+      auto frame = new Picture::ColorFrame(pixels);
+      frame->timestamp = timestamp;
+      frame->sequence = sequence;
+      picture.color_frame.reset(frame);
+   }
+   return picture;
+}
+
+void SyntheticSource::start(bool const color, bool const depth, bool const ir, std::function<void(Picture)> deliver) {
+   stop();
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = false;
+   }
+   all_delivered = false;
+   generation_thread = std::thread(&SyntheticSource::generation_loop, this, color, depth, ir, std::move(deliver));
+}
+
+void SyntheticSource::stop() {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   stop_requested.notify_all();
+   if (generation_thread.joinable()) {
+      generation_thread.join();
+   }
+}
+
+void SyntheticSource::generation_loop(
+      bool const color, bool const depth, bool const ir, std::function<void(Picture)> deliver) {
+   auto const started = std::chrono::steady_clock::now();
+   for (uint64_t n = 0; settings.frame_limit == 0 || n < settings.frame_limit; ++n) {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         if (settings.fps > 0.0) {
+            auto const due = started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                             std::chrono::duration<double>(double(n) / settings.fps));
+            stop_requested.wait_until(lock, due, [this] { return stopping; });
+         }
+         if (stopping) {
+            return;
+         }
+      }
+      Picture picture = generate(n, color, depth, ir);
+      // Delivered one frame per picture, like the Kinect callbacks do.
+      if (picture.depth_frame) {
+         Picture depth_only;
+         depth_only.depth_frame = std::move(picture.depth_frame);
+         deliver(std::move(depth_only));
+      }
+      if (picture.ir_frame) {
+         Picture ir_only;
+         ir_only.ir_frame = std::move(picture.ir_frame);
+         deliver(std::move(ir_only));
+      }
+      if (picture.color_frame) {
+         Picture color_only;
+         color_only.color_frame = std::move(picture.color_frame);
+         deliver(std::move(color_only));
+      }
+      ++delivered_count;
+   }
+   all_delivered = true;
+}
+
+#endif
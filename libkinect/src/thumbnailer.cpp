@@ -17,10 +17,15 @@
    along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <execution>
+#include <numeric>
+
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "matrix_expression.hpp"
 #include "picture.hpp"
 
 const float min_depth = 500.0;
@@ -36,36 +41,30 @@ int main(int argc, char **argv) {
    auto thumb_max_size = static_cast<size_t>(std::stoi(argv[3]));
    size_t thumb_width = thumb_max_size;
    size_t thumb_height = thumb_max_size;
-   if (frame.pixels->width > frame.pixels->height) {
-      thumb_height = thumb_max_size * frame.pixels->height / frame.pixels->width;
+   if (frame.width() > frame.height()) {
+      thumb_height = thumb_max_size * frame.height() / frame.width();
    } else {
-      thumb_width = thumb_max_size * frame.pixels->width / frame.pixels->height;
+      thumb_width = thumb_max_size * frame.width() / frame.height();
    }
    frame.resize(thumb_width, thumb_height);
-   auto int_pixels = new uint8_t[thumb_width * thumb_height];
+   Matrix<uint8_t> int_pixels(thumb_height, thumb_width);
+   auto const pixels = frame.float_pixels().pixels();
    float max_ir = 0.0;
    if (!frame.is_depth) {
-      for (size_t i = 0; i < thumb_width * thumb_height; ++i) {
-         max_ir = std::max(max_ir, frame.pixels->data()[i]);
-      }
+      // NaN counts as 0, as it did for std::max() in a loop; without NaN max is associative, as std::reduce needs.
+      max_ir = std::transform_reduce(std::execution::par_unseq, pixels.begin(), pixels.end(), 0.0f,
+            [](float const a, float const b) { return std::max(a, b); },
+            [](float const value) { return value == value ? value : 0.0f; });
       if (max_ir <= 1024.0) {  // Kinect v1
          max_ir = max_ir_v1;
       } else {  // Kinect v2
          max_ir = std::max(max_ir, max_ir_v2);
       }
    }
-   for (size_t i = 0; i < thumb_width * thumb_height; ++i) {
-      float val;
-      if (frame.is_depth) {
-         val = 255.0f * (frame.pixels->data()[i] - min_depth) / (max_depth - min_depth);
-      } else {
-         val = 255.0f * frame.pixels->data()[i] / max_ir;
-      }
-      val = std::min(val, 255.0f);
-      val = std::max(val, 0.0f);
-      int_pixels[i] = static_cast<uint8_t>(val);
-   }
-   cv::Mat current_image(cv::Size(static_cast<int>(thumb_width), static_cast<int>(thumb_height)), CV_8UC1, int_pixels);
+   float const low = frame.is_depth ? min_depth : 0.0f, high = frame.is_depth ? max_depth : max_ir;
+   evaluate(cast<uint8_t>(clamp(255.0f * (frame.float_pixels() - low) / (high - low), 0.0f, 255.0f)), int_pixels);
+   cv::Mat current_image(
+         cv::Size(static_cast<int>(thumb_width), static_cast<int>(thumb_height)), CV_8UC1, int_pixels.data());
    if (frame.is_depth) {
       cv::Mat destination_image(cv::Size(static_cast<int>(thumb_width), static_cast<int>(thumb_height)), CV_8UC3);
       cv::applyColorMap(current_image, destination_image, cv::COLORMAP_RAINBOW);
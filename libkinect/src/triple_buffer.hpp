@@ -0,0 +1,87 @@
+/*
+   Novelty face authentication with liveness detection using depth and IR camera
+   Copyright (C) 2017-2018
+   Tomasz Garbus, Dominik Klemba, Jan Ludziejewski, Łukasz Raszkiewicz
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// Declarations
+
+// Lock-free handoff of the newest value from one writer thread to one reader thread. The writer fills the write
+// buffer and publishes it, the reader takes the newest published buffer when it wants one. Neither ever waits for
+// the other; values published while the reader wasn't looking are skipped.
+template <typename T>
+class TripleBuffer {
+ public:
+   TripleBuffer() = default;
+   explicit TripleBuffer(T const &initial);
+   TripleBuffer(const TripleBuffer &src) = delete;
+
+   // Writer only. Keeps whatever was written to it three publishes ago, so it should be overwritten entirely.
+   T &write_buffer();
+   // Writer only. Makes the write buffer the newest value and starts a new write buffer.
+   void publish();
+
+   // Reader only. Switches to the newest published value, returns false if nothing was published since last time.
+   bool update();
+   // Reader only.
+   T const &read_buffer() const;
+
+ private:
+   static uint8_t constexpr index_mask = 3, fresh_bit = 4;
+
+   T buffers[3];
+   alignas(64) uint8_t write_index = 0;
+   alignas(64) uint8_t read_index = 1;
+   // Index of the buffer which is neither being written nor read, with fresh_bit if it was published and not read.
+   alignas(64) std::atomic<uint8_t> middle{2};
+};
+
+// Definitions
+
+template <typename T>
+TripleBuffer<T>::TripleBuffer(T const &initial) : buffers{initial, initial, initial} {}
+
+template <typename T>
+T &TripleBuffer<T>::write_buffer() {
+   return buffers[write_index];
+}
+
+template <typename T>
+void TripleBuffer<T>::publish() {
+   write_index = middle.exchange(write_index | fresh_bit, std::memory_order_acq_rel) & index_mask;
+}
+
+template <typename T>
+bool TripleBuffer<T>::update() {
+   if ((middle.load(std::memory_order_relaxed) & fresh_bit) == 0) {
+      return false;
+   }
+   read_index = middle.exchange(read_index, std::memory_order_acq_rel) & index_mask;
+   return true;
+}
+
+template <typename T>
+T const &TripleBuffer<T>::read_buffer() const {
+   return buffers[read_index];
+}
+
+#endif